@@ -0,0 +1,138 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_AFFINITY_H_
+#define ECHIDNA_AFFINITY_H_
+
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <boost/utility.hpp>
+
+#if defined( __linux__ )
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace echidna
+{
+
+// Insieme di CPU (numerate da 0) a cui legare un thread; vuoto significa tutte.
+typedef std::vector< unsigned > CpuSet;
+
+// Legge un elenco di CPU nel formato di taskset, es. "0-3,8,10-11".
+inline CpuSet ParseCpuSet( const std::string& list )
+{
+    std::vector< std::string > items;
+    boost::algorithm::split( items, list, boost::algorithm::is_any_of( "," ) );
+    CpuSet cpus;
+    for ( std::vector< std::string >::const_iterator i = items.begin(); i != items.end(); ++i )
+    {
+        const std::string item = boost::algorithm::trim_copy( *i );
+        if ( item.empty() )
+            continue;
+        char* end;
+        const unsigned long first = std::strtoul( item.c_str(), &end, 10 );
+        unsigned long last = first;
+        if ( *end == '-' )
+            last = std::strtoul( end + 1, &end, 10 );
+        if ( end == item.c_str() || *end != '\0' || last < first )
+            throw std::invalid_argument( "bad cpu list: " + list );
+        for ( unsigned long cpu = first; cpu <= last; ++cpu )
+            cpus.push_back( static_cast< unsigned >( cpu ) );
+    }
+    return cpus;
+}
+
+#if defined( __linux__ )
+
+// Lega il thread corrente alle CPU cpus (se cpus e' vuoto non fa niente).
+// Ritorna false se non e' possibile (CPU inesistenti o piattaforma non supportata).
+inline bool PinCurrentThread( const CpuSet& cpus )
+{
+    if ( cpus.empty() )
+        return true;
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    for ( CpuSet::const_iterator i = cpus.begin(); i != cpus.end(); ++i )
+    {
+        if ( *i >= CPU_SETSIZE )
+            return false;
+        CPU_SET( *i, &set );
+    }
+    if ( pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) != 0 )
+        return false;
+    // il kernel toglie in silenzio le CPU che non esistono (o che il processo
+    // non puo' usare), purche' ne resti almeno una
+    cpu_set_t actual;
+    return pthread_getaffinity_np( pthread_self(), sizeof( actual ), &actual ) == 0 && CPU_EQUAL( &set, &actual );
+}
+
+// Lega il thread corrente alle CPU cpus finche' l'oggetto esiste.
+// La memoria toccata per la prima volta in questo intervallo viene allocata
+// dal kernel sul nodo NUMA di quelle CPU (politica first-touch), e i thread
+// creati in questo intervallo ne ereditano l'affinita'.
+class ScopedAffinity : private boost::noncopyable
+{
+public:
+    explicit ScopedAffinity( const CpuSet& cpus ) :
+        restore( !cpus.empty() && pthread_getaffinity_np( pthread_self(), sizeof( previous ), &previous ) == 0 ),
+        pinned( cpus.empty() || ( restore && PinCurrentThread( cpus ) ) )
+    {
+    }
+    ~ScopedAffinity()
+    {
+        if ( restore )
+            pthread_setaffinity_np( pthread_self(), sizeof( previous ), &previous );
+    }
+    // false se non e' stato possibile legare il thread alle CPU
+    bool Pinned() const { return pinned; }
+private:
+    cpu_set_t previous;
+    const bool restore;
+    const bool pinned;
+};
+
+#else
+
+inline bool PinCurrentThread( const CpuSet& cpus )
+{
+    return cpus.empty();
+}
+
+class ScopedAffinity : private boost::noncopyable
+{
+public:
+    explicit ScopedAffinity( const CpuSet& cpus ) : pinned( cpus.empty() ) {}
+    bool Pinned() const { return pinned; }
+private:
+    const bool pinned;
+};
+
+#endif
+
+} // namespace echidna
+
+#endif // ECHIDNA_AFFINITY_H_
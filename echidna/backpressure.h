@@ -0,0 +1,110 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_BACKPRESSURE_H_
+#define ECHIDNA_BACKPRESSURE_H_
+
+#include <cstddef>
+#include <boost/atomic.hpp>
+#include <boost/utility.hpp>
+
+namespace echidna
+{
+
+// Cosa fa EventBus::Post quando la coda (o la quota di un tipo di evento) e' piena.
+struct Backpressure
+{
+    enum Policy
+    {
+        Block,      // il produttore aspetta che si liberi un posto
+        Fail,       // l'evento non viene accodato e TryPost ritorna false
+        DropOldest, // viene scartato l'evento piu' vecchio in coda (solo per l'intero bus)
+        DropNewest  // viene scartato l'evento che si sta accodando
+    };
+};
+
+// Quante volte e' scattata ciascuna politica.
+struct BackpressureStats
+{
+    BackpressureStats() : blocked( 0 ), failed( 0 ), droppedOldest( 0 ), droppedNewest( 0 ) {}
+    unsigned long blocked;
+    unsigned long failed;
+    unsigned long droppedOldest;
+    unsigned long droppedNewest;
+};
+
+class BackpressureCounters : private boost::noncopyable
+{
+public:
+    BackpressureCounters()
+    {
+        for ( unsigned i = 0; i < Policies; ++i )
+            counters[ i ] = 0;
+    }
+    void Count( Backpressure::Policy p )
+    {
+        counters[ p ].fetch_add( 1, boost::memory_order_relaxed );
+    }
+    BackpressureStats Get() const
+    {
+        BackpressureStats s;
+        s.blocked = counters[ Backpressure::Block ];
+        s.failed = counters[ Backpressure::Fail ];
+        s.droppedOldest = counters[ Backpressure::DropOldest ];
+        s.droppedNewest = counters[ Backpressure::DropNewest ];
+        return s;
+    }
+private:
+    enum { Policies = Backpressure::DropNewest + 1 };
+    boost::atomic< unsigned long > counters[ Policies ];
+};
+
+// Numero massimo di eventi di un certo tipo che possono stare in coda.
+class EventQuota : private boost::noncopyable
+{
+public:
+    EventQuota( std::size_t c, Backpressure::Policy p ) : capacity( c ), policy( p ), queued( 0 ) {}
+
+    boost::atomic< std::size_t > capacity;
+    boost::atomic< Backpressure::Policy > policy;
+    boost::atomic< std::size_t > queued; // eventi del tipo attualmente in coda
+    BackpressureCounters counters;
+
+    // riserva un posto, se c'e'
+    bool TryAcquire()
+    {
+        std::size_t n = queued.load();
+        while ( n < capacity.load() )
+            if ( queued.compare_exchange_weak( n, n + 1 ) )
+                return true;
+        return false;
+    }
+
+    bool Full() const { return queued.load() >= capacity.load(); }
+
+    void Release() { --queued; }
+};
+
+} // namespace echidna
+
+#endif // ECHIDNA_BACKPRESSURE_H_
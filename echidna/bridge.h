@@ -0,0 +1,87 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_BRIDGE_H_
+#define ECHIDNA_BRIDGE_H_
+
+#include <map>
+#include <string>
+#include "eventbus.h"
+
+namespace echidna
+{
+
+// Registro dei tipi di evento che il Container puo' inoltrare da un bus all'altro
+// (vedi EventBus::Bridge), indicati per nome nella configurazione.
+// Un tipo si registra con REG_BRIDGE, come i componenti con DEFINE_COMPONENT.
+class BridgeRegistry
+{
+public:
+    typedef EventBus::Subscription ( *Connector )( EventBus& from, EventBus& to );
+
+    static void Register( const std::string& name, Connector c )
+    {
+        Reg().insert( std::make_pair( name, c ) );
+    }
+
+    // NULL se il tipo non e' registrato
+    static Connector ForName( const std::string& name )
+    {
+        const Connectors::const_iterator i = Reg().find( name );
+        return i == Reg().end() ? NULL : i -> second;
+    }
+
+private:
+    typedef std::map< std::string, Connector > Connectors;
+
+    static Connectors& Reg()
+    {
+        static Connectors reg;
+        return reg;
+    }
+};
+
+template < typename E >
+EventBus::Subscription ConnectBridge( EventBus& from, EventBus& to )
+{
+    return from.Bridge< E >( to );
+}
+
+template < typename E >
+class BridgeEntry
+{
+public:
+    explicit BridgeEntry( const char* name )
+    {
+        BridgeRegistry::Register( name, &ConnectBridge< E > );
+    }
+};
+
+} // namespace echidna
+
+// Da usare nel namespace globale, una volta sola per tipo, es. REG_BRIDGE( Quote );
+// E deve essere un identificatore semplice (per i tipi in un namespace si usa un typedef).
+#define REG_BRIDGE( E ) \
+static const echidna::BridgeEntry< E > E##Bridge__( #E )
+
+#endif // ECHIDNA_BRIDGE_H_
@@ -0,0 +1,249 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_CODEC_H_
+#define ECHIDNA_CODEC_H_
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/preprocessor/seq/for_each.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <boost/type_traits/has_trivial_copy.hpp>
+#include <boost/type_traits/has_trivial_destructor.hpp>
+
+namespace echidna
+{
+
+// Un codec C trasforma gli eventi di tipo E in byte e viceversa, senza allocazioni:
+//
+//   static std::size_t Size( const E& e );              // byte necessari per codificare e
+//   static void Encode( const E& e, char* out );         // scrive esattamente Size( e ) byte in out
+//   static E Decode( const char* in, std::size_t size ); // tira CodecError se i byte non sono validi
+//
+// out e in non sono allineati: i campi vanno copiati con memcpy.
+// Per gli eventi con campi di lunghezza variabile (stringhe, vettori) si scrive
+// un codec con lo schema dell'evento, es. la lunghezza seguita dai caratteri.
+
+class CodecError : public std::runtime_error
+{
+public:
+    explicit CodecError( const std::string& what ) : std::runtime_error( what ) {}
+};
+
+// IsCodec< S, E >::value e' vero se S e' un codec per E (ha Encode), falso
+// se e' un serializzatore a stringhe (ToStream/FromStream, vedi EventMirror).
+template < typename S, typename E >
+class IsCodec
+{
+    template < void ( * )( const E&, char* ) >
+    struct Check;
+    template < typename T >
+    static char Test( Check< &T::Encode >* );
+    template < typename T >
+    static long Test( ... );
+public:
+    enum { value = sizeof( Test< S >( 0 ) ) == sizeof( char ) };
+};
+
+// Codec degli eventi copiabili byte per byte (senza puntatori, stringhe, ecc.).
+// Va bene solo tra processi compilati con lo stesso compilatore per la stessa architettura.
+template < typename E >
+struct PodCodec
+{
+    BOOST_STATIC_ASSERT( boost::has_trivial_copy< E >::value && boost::has_trivial_destructor< E >::value );
+
+    static std::size_t Size( const E& )
+    {
+        return sizeof( E );
+    }
+    static void Encode( const E& e, char* out )
+    {
+        std::memcpy( out, &e, sizeof( E ) );
+    }
+    static E Decode( const char* in, std::size_t size )
+    {
+        if ( size != sizeof( E ) )
+            throw CodecError( "PodCodec: wrong event size" );
+        // E potrebbe non avere il costruttore di default
+        typename boost::aligned_storage< sizeof( E ), boost::alignment_of< E >::value >::type buffer;
+        std::memcpy( &buffer, in, sizeof( E ) );
+        return *reinterpret_cast< const E* >( &buffer );
+    }
+};
+
+// Codifica dei campi di un evento, usata dai codec generati con ECHIDNA_STRUCT_CODEC:
+// i tipi copiabili byte per byte cosi' come sono, std::string e std::vector
+// con la lunghezza (32 bit) seguita dagli elementi. Per gli altri tipi
+// si specializza FieldCodec.
+template < typename T >
+struct FieldCodec
+{
+    BOOST_STATIC_ASSERT( boost::has_trivial_copy< T >::value );
+
+    static std::size_t Size( const T& )
+    {
+        return sizeof( T );
+    }
+    static char* Encode( const T& v, char* out )
+    {
+        std::memcpy( out, &v, sizeof( T ) );
+        return out + sizeof( T );
+    }
+    static const char* Decode( T& v, const char* in, const char* end )
+    {
+        if ( static_cast< std::size_t >( end - in ) < sizeof( T ) )
+            throw CodecError( "FieldCodec: truncated field" );
+        std::memcpy( &v, in, sizeof( T ) );
+        return in + sizeof( T );
+    }
+};
+
+template <>
+struct FieldCodec< std::string >
+{
+    static std::size_t Size( const std::string& v )
+    {
+        return sizeof( boost::uint32_t ) + v.size();
+    }
+    static char* Encode( const std::string& v, char* out )
+    {
+        out = FieldCodec< boost::uint32_t >::Encode( static_cast< boost::uint32_t >( v.size() ), out );
+        std::memcpy( out, v.data(), v.size() );
+        return out + v.size();
+    }
+    static const char* Decode( std::string& v, const char* in, const char* end )
+    {
+        boost::uint32_t length;
+        in = FieldCodec< boost::uint32_t >::Decode( length, in, end );
+        if ( static_cast< std::size_t >( end - in ) < length )
+            throw CodecError( "FieldCodec: truncated string" );
+        v.assign( in, length );
+        return in + length;
+    }
+};
+
+template < typename T >
+struct FieldCodec< std::vector< T > >
+{
+    static std::size_t Size( const std::vector< T >& v )
+    {
+        std::size_t size = sizeof( boost::uint32_t );
+        for ( typename std::vector< T >::const_iterator i = v.begin(); i != v.end(); ++i )
+            size += FieldCodec< T >::Size( *i );
+        return size;
+    }
+    static char* Encode( const std::vector< T >& v, char* out )
+    {
+        out = FieldCodec< boost::uint32_t >::Encode( static_cast< boost::uint32_t >( v.size() ), out );
+        for ( typename std::vector< T >::const_iterator i = v.begin(); i != v.end(); ++i )
+            out = FieldCodec< T >::Encode( *i, out );
+        return out;
+    }
+    static const char* Decode( std::vector< T >& v, const char* in, const char* end )
+    {
+        boost::uint32_t length;
+        in = FieldCodec< boost::uint32_t >::Decode( length, in, end );
+        // ogni elemento occupa almeno un byte: una lunghezza non valida non fa allocare
+        if ( static_cast< std::size_t >( end - in ) < length )
+            throw CodecError( "FieldCodec: truncated vector" );
+        v.resize( length );
+        for ( typename std::vector< T >::iterator i = v.begin(); i != v.end(); ++i )
+            in = FieldCodec< T >::Decode( *i, in, end );
+        return in;
+    }
+};
+
+// per dedurre il tipo del campo nelle macro
+template < typename T >
+std::size_t FieldSize( const T& v )
+{
+    return FieldCodec< T >::Size( v );
+}
+
+template < typename T >
+char* EncodeField( const T& v, char* out )
+{
+    return FieldCodec< T >::Encode( v, out );
+}
+
+template < typename T >
+const char* DecodeField( T& v, const char* in, const char* end )
+{
+    return FieldCodec< T >::Decode( v, in, end );
+}
+
+// Tag con cui un tipo di evento viene riconosciuto da un altro processo
+// (nei record di ShmRing e nei frame di SocketLink): i due processi
+// devono usare lo stesso nome per lo stesso tipo.
+inline boost::uint32_t EventTag( const std::string& name )
+{
+    // FNV-1a
+    boost::uint32_t h = 2166136261u;
+    for ( std::string::const_iterator i = name.begin(); i != name.end(); ++i )
+    {
+        h ^= static_cast< unsigned char >( *i );
+        h *= 16777619u;
+    }
+    return h;
+}
+
+} // namespace echidna
+
+// Genera il codec C dell'evento E dall'elenco dei suoi campi pubblici, es.
+//   ECHIDNA_STRUCT_CODEC( OrderCodec, Order, (id)(symbol)(price) );
+// I campi vengono codificati nell'ordine dell'elenco (vedi FieldCodec);
+// E deve avere il costruttore di default.
+#define ECHIDNA_STRUCT_CODEC( C, E, FIELDS ) \
+struct C \
+{ \
+    static std::size_t Size( const E& e ) \
+    { \
+        return 0 BOOST_PP_SEQ_FOR_EACH( ECHIDNA_FIELD_SIZE, e, FIELDS ); \
+    } \
+    static void Encode( const E& e, char* out ) \
+    { \
+        BOOST_PP_SEQ_FOR_EACH( ECHIDNA_FIELD_ENCODE, e, FIELDS ) \
+        ( void ) out; \
+    } \
+    static E Decode( const char* in, std::size_t size ) \
+    { \
+        const char* const end = in + size; \
+        E e; \
+        BOOST_PP_SEQ_FOR_EACH( ECHIDNA_FIELD_DECODE, e, FIELDS ) \
+        if ( in != end ) \
+            throw echidna::CodecError( #C ": wrong size" ); \
+        return e; \
+    } \
+}
+
+#define ECHIDNA_FIELD_SIZE( r, e, field ) + echidna::FieldSize( e.field )
+#define ECHIDNA_FIELD_ENCODE( r, e, field ) out = echidna::EncodeField( e.field, out );
+#define ECHIDNA_FIELD_DECODE( r, e, field ) in = echidna::DecodeField( e.field, in, end );
+
+#endif // ECHIDNA_CODEC_H_
@@ -39,6 +39,9 @@ public:
     typedef boost::shared_ptr< EventBus > EventBusPtr;
 
     virtual ~Component() {}
+    // Se il componente usa piu' bus (parametro "bus" della configurazione, es. "feed,default"),
+    // prima di Init riceve quelli successivi al primo, che viene passato a Init.
+    virtual void Attach( const std::string& /*busName*/, EventBusPtr /*bus*/ ) {}
     virtual void Init( const std::string& instanceName, CfgPtr cfg, EventBusPtr msgBroker ) = 0;
     virtual void Start() = 0;
     virtual void Stop() = 0;
@@ -0,0 +1,119 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_CONFLATION_H_
+#define ECHIDNA_CONFLATION_H_
+
+#include <boost/function.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+#include "envelope.h"
+
+namespace echidna
+{
+
+class Conflator;
+
+// Segnaposto accodato al posto di un evento soggetto a conflation:
+// al momento della consegna viene sostituito dall'ultimo valore
+// postato con la stessa chiave.
+struct ConflatedEvent
+{
+    Conflator* owner;
+    void* slot;
+};
+
+class Conflator : private boost::noncopyable
+{
+public:
+    virtual ~Conflator() {}
+    // Se c'e' gia' in coda un evento con la stessa chiave lo sostituisce e ritorna false.
+    // Altrimenti ritorna true e riempie token, che va accodato.
+    virtual bool Offer( const void* event, ConflatedEvent& token ) = 0;
+    // Ritorna l'ultimo valore del segnaposto e lo libera.
+    virtual Envelope Take( void* slot ) = 0;
+};
+
+// Conflation degli eventi di tipo E con chiave di tipo K
+// (K deve poter essere usato in una boost::unordered_map).
+template < typename E, typename K >
+class KeyConflator : public Conflator
+{
+public:
+    typedef boost::function< K ( const E& ) > KeyFunction;
+
+    explicit KeyConflator( KeyFunction k ) : key( k ) {}
+
+    virtual ~KeyConflator()
+    {
+        for ( typename Slots::const_iterator i = slots.begin(); i != slots.end(); ++i )
+            delete i -> second;
+    }
+
+    virtual bool Offer( const void* event, ConflatedEvent& token )
+    {
+        const E& e = *static_cast< const E* >( event );
+        const K k = key( e );
+        boost::lock_guard< boost::mutex > lock( mtx );
+        typename Slots::iterator i = slots.find( k );
+        if ( i != slots.end() )
+        {
+            i -> second -> latest = Envelope( e );
+            return false;
+        }
+        Slot* s = new Slot( k, e );
+        slots.insert( std::make_pair( k, s ) );
+        token.owner = this;
+        token.slot = s;
+        return true;
+    }
+
+    virtual Envelope Take( void* slot )
+    {
+        Slot* s = static_cast< Slot* >( slot );
+        boost::lock_guard< boost::mutex > lock( mtx );
+        const Envelope latest( s -> latest );
+        slots.erase( s -> key );
+        delete s;
+        return latest;
+    }
+
+private:
+    struct Slot
+    {
+        Slot( const K& k, const E& e ) : key( k ), latest( e ) {}
+        const K key;
+        Envelope latest;
+    };
+    typedef boost::unordered_map< K, Slot* > Slots;
+
+    KeyFunction key;
+    boost::mutex mtx;
+    Slots slots; // un elemento per ogni chiave che ha un evento in coda
+};
+
+} // namespace echidna
+
+#endif // ECHIDNA_CONFLATION_H_
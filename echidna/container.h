@@ -25,9 +25,16 @@
 #define ECHIDNA_CONTAINER_H_
 
 #include <stdexcept>
+#include <map>
 #include <memory>
+#include <set>
+#include <utility>
+#include <boost/algorithm/string.hpp>
+#include <boost/atomic.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 #include <vector>
+#include "bridge.h"
 #include "eventbus.h"
 #include "component.h"
 #include "exit.h"
@@ -78,14 +85,46 @@ public:
 private:
 
     typedef boost::shared_ptr< const Configuration > CfgConstPtr;
+    typedef boost::shared_ptr< EventBus > EventBusPtr;
 
+    // nome del bus configurato nella sezione "eventbus"
+    static const char* DefaultBus() { return "default"; }
+    // sezione della configurazione del bus name
+    static std::string BusSection( const std::string& name )
+    {
+        return name == DefaultBus() ? "eventbus" : "buses." + name;
+    }
+
+    static EventBus* NewEventBus( const Configuration& busCfg, const std::string& section ) throw ( CfgError );
+    static void AddWorkerGroup( EventBus* bus, const std::string& section, const std::string& name, const Configuration& groupCfg )
+        throw ( CfgError );
+    template < typename T >
+    static T GetOptional( const Configuration& cfg, const std::string& key, T defaultValue );
+    static Configuration GetSection( const Configuration& cfg, const std::string& path );
+    static CpuSet GetCpus( const Configuration& busCfg, const std::string& section ) throw ( CfgError );
+    void AddBus( const std::string& name, const Configuration& busCfg ) throw ( CfgError );
+    void AddBridge( const std::string& name, const Configuration& bridgeCfg ) throw ( CfgError );
+    EventBusPtr FindBus( const std::string& name, const std::string& key ) const throw ( CfgError );
+    void RunBus( EventBusPtr bus );
     void LoadComponents( CfgConstPtr cfg ) throw ( CfgError, MissingComponentError );
     void CreateComponent( const std::string& instanceName, const Configuration& componentCfg, CfgConstPtr cfg )
         throw ( CfgError, MissingComponentError );
 
-    volatile bool running;
-    boost::shared_ptr< EventBus > broker;
+    // strand di un componente su ognuno dei suoi bus (vedi CreateComponent)
+    typedef std::vector< std::pair< EventBusPtr, EventBus::StrandPtr > > Mailboxes;
+    typedef std::vector< boost::shared_ptr< EventBus::StrandScope > > MailboxScopes;
+    static void OpenMailboxes( const Mailboxes& m, MailboxScopes& scopes );
+
+    boost::atomic< bool > running; // letto dai thread dei bus, scritto da Stop
+    const CpuSet loopCpus; // CPU del thread che esegue Run
+    EventBusPtr broker; // il bus di default, gestito dal thread che esegue Run
+    // gli altri bus (sezione "buses"), ognuno gestito da un suo thread
+    std::map< std::string, EventBusPtr > buses;
+    std::map< std::string, CpuSet > busCpus;
+    std::set< std::string > bridges; // "evento da a", per trovare i ponti inversi
+    boost::thread_group loops;
     std::vector< boost::shared_ptr< Component > > components;
+    std::vector< Mailboxes > mailboxes; // le mailbox di components[ i ]
 };
 
 
@@ -95,14 +134,21 @@ private:
 inline Container::Container( std::auto_ptr< Configuration > _cfg )
     throw ( CfgError, MissingComponentError ) :
     running( false ),
-    broker( new EventBus() )
+    loopCpus( GetCpus( GetSection( *_cfg, "eventbus" ), "eventbus" ) ),
+    broker( NewEventBus( GetSection( *_cfg, "eventbus" ), "eventbus" ) )
 {
     // utilizza uno shared_ptr in modo che quando tutti i componenti hanno
     // letto la configurazione, pu essere rilasciata dalla memoria
     CfgConstPtr cfg( _cfg );
 
-    // inserisce l'evento di terminazione
+    // crea gli altri bus e i ponti tra i bus
+    GetSection( *cfg, "buses" ).Iterate( boost::bind( &Container::AddBus, this, _1, _2 ) );
+    GetSection( *cfg, "bridges" ).Iterate( boost::bind( &Container::AddBridge, this, _1, _2 ) );
+
+    // inserisce l'evento di terminazione (su tutti i bus)
     broker -> Subscribe< event::Exit >( boost::bind( &Container::StopFromInside, this, _1 ) );
+    for ( std::map< std::string, EventBusPtr >::const_iterator i = buses.begin(); i != buses.end(); ++i )
+        i -> second -> Subscribe< event::Exit >( boost::bind( &Container::StopFromInside, this, _1 ) );
 
     // crea i componenti e li inizializza
     LoadComponents( cfg );
@@ -111,6 +157,11 @@ inline Container::Container( std::auto_ptr< Configuration > _cfg )
 inline Container::~Container()
 {
     Stop( 0 );
+    loops.join_all();
+    // i worker dei bus non devono piu' invocare i componenti che stanno per essere distrutti
+    broker -> Join();
+    for ( std::map< std::string, EventBusPtr >::const_iterator i = buses.begin(); i != buses.end(); ++i )
+        i -> second -> Join();
 }
 
 inline void Container::Run()
@@ -118,25 +169,47 @@ inline void Container::Run()
     if ( running )
         return;
 
-    for_each(
-        components.begin(),
-        components.end(),
-        boost::bind( &Component::Start, _1 )
-    );
+    // anche le sottoscrizioni e i task creati da Start usano le mailbox del componente
+    for ( std::size_t i = 0; i < components.size(); ++i )
+    {
+        MailboxScopes scopes;
+        OpenMailboxes( mailboxes[ i ], scopes );
+        components[ i ] -> Start();
+    }
 
     running = true;
+    for ( std::map< std::string, EventBusPtr >::const_iterator i = buses.begin(); i != buses.end(); ++i )
+    {
+        // il thread del bus eredita l'affinita' del thread che lo crea
+        // (le CPU sono gia' state verificate da GetCpus)
+        ScopedAffinity pinned( busCpus[ i -> first ] );
+        if ( !pinned.Pinned() )
+            throw CfgError( "buses." + i -> first + ".cpus" );
+        loops.create_thread( boost::bind( &Container::RunBus, this, i -> second ) );
+    }
+
+    if ( !PinCurrentThread( loopCpus ) )
+        throw CfgError( "eventbus.cpus" );
     while ( running )
         broker -> Run();
 
 }
 
+inline void Container::RunBus( EventBusPtr bus )
+{
+    while ( running )
+        bus -> Run();
+}
+
 inline void Container::Stop( int /*code*/ )
 {
-    if ( !running )
+    // solo il primo Stop ferma i bus (Stop puo' arrivare da piu' thread)
+    if ( !running.exchange( false ) )
         return;
 
-    running = false;
     broker -> Stop();
+    for ( std::map< std::string, EventBusPtr >::const_iterator i = buses.begin(); i != buses.end(); ++i )
+        i -> second -> Stop();
 
     for_each(
         components.begin(),
@@ -150,6 +223,158 @@ inline void Container::StopFromInside( event::Exit e )
     Stop( e.code );
 }
 
+inline EventBus* Container::NewEventBus( const Configuration& busCfg, const std::string& section ) throw ( CfgError )
+{
+    // i parametri sono tutti opzionali: di default gli handler vengono eseguiti
+    // dal thread che invoca Run e la coda e' illimitata
+    const unsigned threads = GetOptional< unsigned >( busCfg, "threads", 0 );
+    const std::size_t capacity = GetOptional< std::size_t >( busCfg, "capacity", 0 );
+    const std::string policyName = GetOptional< std::string >( busCfg, "policy", "block" );
+
+    Backpressure::Policy policy;
+    if ( policyName == "block" ) policy = Backpressure::Block;
+    else if ( policyName == "fail" ) policy = Backpressure::Fail;
+    else if ( policyName == "drop_oldest" ) policy = Backpressure::DropOldest;
+    else if ( policyName == "drop_newest" ) policy = Backpressure::DropNewest;
+    else throw CfgError( section + ".policy (block|fail|drop_oldest|drop_newest)" );
+
+    // attesa del thread che esegue Run: di default si addormenta subito
+    const std::string waitName = GetOptional< std::string >( busCfg, "wait", "block" );
+    const unsigned spinUs = GetOptional< unsigned >( busCfg, "spin_us", 50 );
+
+    WaitStrategy strategy( WaitStrategy::Block, boost::chrono::microseconds( spinUs ) );
+    if ( waitName == "block" ) strategy.mode = WaitStrategy::Block;
+    else if ( waitName == "park" ) strategy.mode = WaitStrategy::Park;
+    else if ( waitName == "yield" ) strategy.mode = WaitStrategy::Yield;
+    else if ( waitName == "spin" ) strategy.mode = WaitStrategy::Spin;
+    else throw CfgError( section + ".wait (block|park|yield|spin)" );
+
+    EventBus* bus;
+    {
+        // la coda viene allocata (e il pool di thread creato) da un thread legato
+        // alle CPU del bus: la memoria finisce sul loro nodo NUMA e i worker
+        // ne ereditano l'affinita'
+        ScopedAffinity local( GetCpus( busCfg, section ) );
+        bus = new EventBus( threads, capacity, policy );
+    }
+    bus -> SetWaitStrategy( strategy );
+
+    // gruppi di thread opzionali, a cui i componenti possono essere assegnati
+    try
+    {
+        GetSection( busCfg, "groups" ).Iterate( boost::bind( &Container::AddWorkerGroup, bus, section, _1, _2 ) );
+    }
+    catch ( ... )
+    {
+        delete bus;
+        throw;
+    }
+    return bus;
+}
+
+inline void Container::AddWorkerGroup( EventBus* bus, const std::string& section, const std::string& name, const Configuration& groupCfg )
+    throw ( CfgError )
+{
+    const std::string key = section + ".groups." + name;
+    const unsigned threads = GetOptional< unsigned >( groupCfg, "threads", 1 );
+    try
+    {
+        bus -> AddWorkerGroup( name, threads, GetCpus( groupCfg, key ) );
+    }
+    catch ( const std::invalid_argument& )
+    {
+        throw CfgError( key + ".threads" );
+    }
+}
+
+// Un bus in piu', configurato come quello di default. I bus sono isolati tra loro:
+// ognuno ha la sua coda e il suo thread (legato alle CPU del parametro "cpus").
+inline void Container::AddBus( const std::string& name, const Configuration& busCfg ) throw ( CfgError )
+{
+    const std::string section = "buses." + name;
+    if ( name == DefaultBus() || buses.find( name ) != buses.end() )
+        throw CfgError( section + " (duplicate bus)" );
+    buses[ name ] = EventBusPtr( NewEventBus( busCfg, section ) );
+    busCpus[ name ] = GetCpus( busCfg, section );
+}
+
+// Inoltra gli eventi di tipo "event" (registrato con REG_BRIDGE) dal bus "from"
+// al bus "to" (di default, il bus di default).
+inline void Container::AddBridge( const std::string& name, const Configuration& bridgeCfg ) throw ( CfgError )
+{
+    const std::string section = "bridges." + name;
+    const std::string event = GetOptional< std::string >( bridgeCfg, "event", "" );
+    const BridgeRegistry::Connector connect = BridgeRegistry::ForName( event );
+    if ( connect == NULL )
+        throw CfgError( section + ".event" );
+    const std::string fromName = GetOptional< std::string >( bridgeCfg, "from", DefaultBus() );
+    const std::string toName = GetOptional< std::string >( bridgeCfg, "to", DefaultBus() );
+    const EventBusPtr from = FindBus( fromName, section + ".from" );
+    const EventBusPtr to = FindBus( toName, section + ".to" );
+    if ( from == to )
+        throw CfgError( section + ".to (same bus as from)" );
+    // con il ponte inverso ogni evento rimbalzerebbe tra i due bus all'infinito
+    if ( bridges.count( event + ' ' + toName + ' ' + fromName ) )
+        throw CfgError( section + ".to (another bridge forwards " + event + " the other way)" );
+    bridges.insert( event + ' ' + fromName + ' ' + toName );
+    connect( *from, *to );
+}
+
+inline Container::EventBusPtr Container::FindBus( const std::string& name, const std::string& key ) const throw ( CfgError )
+{
+    if ( name == DefaultBus() )
+        return broker;
+    const std::map< std::string, EventBusPtr >::const_iterator i = buses.find( name );
+    if ( i == buses.end() )
+        throw CfgError( key + " (unknown bus " + name + ")" );
+    return i -> second;
+}
+
+// elenco di CPU nel formato di taskset (es. "0-3,8"); se manca, tutte le CPU
+inline CpuSet Container::GetCpus( const Configuration& busCfg, const std::string& section ) throw ( CfgError )
+{
+    CpuSet cpus;
+    try
+    {
+        cpus = ParseCpuSet( GetOptional< std::string >( busCfg, "cpus", "" ) );
+    }
+    catch ( const std::invalid_argument& )
+    {
+        throw CfgError( section + ".cpus" );
+    }
+    // si verifica subito che un thread si possa legare a quelle CPU
+    // (es. che esistano e che il processo le possa usare)
+    if ( !ScopedAffinity( cpus ).Pinned() )
+        throw CfgError( section + ".cpus" );
+    return cpus;
+}
+
+// la sezione path, vuota se non c'e'
+inline Configuration Container::GetSection( const Configuration& cfg, const std::string& path )
+{
+    try
+    {
+        return cfg.GetChild( path );
+    }
+    catch ( const std::range_error& )
+    {
+        return Configuration();
+    }
+}
+
+template < typename T >
+inline T Container::GetOptional( const Configuration& cfg, const std::string& key, T defaultValue )
+{
+    try
+    {
+        return cfg.Get< T >( key );
+    }
+    catch ( const std::range_error& )
+    {
+        return defaultValue;
+    }
+}
+
 inline void Container::LoadComponents( CfgConstPtr cfg )
     throw ( CfgError, MissingComponentError )
 {
@@ -176,8 +401,45 @@ inline void Container::CreateComponent( const std::string& instanceName, const C
         else
         {
             boost::shared_ptr< Component > c( instance );
+
+            // bus usati dal componente (parametro opzionale "bus", es. "feed,default"):
+            // il primo viene passato a Init, gli altri ad Attach
+            const string busList = GetOptional< string >( componentCfg, "bus", DefaultBus() );
+            vector< string > names;
+            boost::algorithm::split( names, busList, boost::algorithm::is_any_of( "," ) );
+            vector< EventBusPtr > componentBuses;
+            for ( vector< string >::iterator n = names.begin(); n != names.end(); ++n )
+            {
+                boost::algorithm::trim( *n );
+                componentBuses.push_back( FindBus( *n, instanceName + ".bus" ) );
+            }
+
+            // ogni componente ha la sua mailbox su ogni bus: i suoi handler vengono eseguiti
+            // uno alla volta e in ordine, ma in parallelo a quelli degli altri componenti
+            // (sul primo bus, dai thread del gruppo indicato dal parametro opzionale "group")
+            const string group = GetOptional< string >( componentCfg, "group", "" );
+            Mailboxes m;
+            for ( size_t i = 0; i < componentBuses.size(); ++i )
+            {
+                EventBus& bus = *componentBuses[ i ];
+                EventBus::StrandPtr strand;
+                try
+                {
+                    strand = ( i > 0 || group.empty() ) ? bus.NewStrand() : bus.NewStrand( group );
+                }
+                catch ( const invalid_argument& )
+                {
+                    throw CfgError( BusSection( names[ 0 ] ) + ".groups." + group );
+                }
+                m.push_back( make_pair( componentBuses[ i ], strand ) );
+            }
             components.push_back( c );
-            c -> Init( instanceName, cfg, broker );
+            mailboxes.push_back( m );
+            MailboxScopes scopes;
+            OpenMailboxes( m, scopes );
+            for ( size_t i = 1; i < componentBuses.size(); ++i )
+                c -> Attach( names[ i ], componentBuses[ i ] );
+            c -> Init( instanceName, cfg, componentBuses[ 0 ] );
         }
     }
     catch ( const range_error& )
@@ -186,6 +448,12 @@ inline void Container::CreateComponent( const std::string& instanceName, const C
     }
 }
 
+inline void Container::OpenMailboxes( const Mailboxes& m, MailboxScopes& scopes )
+{
+    for ( Mailboxes::const_iterator i = m.begin(); i != m.end(); ++i )
+        scopes.push_back( boost::shared_ptr< EventBus::StrandScope >( new EventBus::StrandScope( *i -> first, i -> second ) ) );
+}
+
 
 } // namespace echidna
 
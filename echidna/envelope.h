@@ -0,0 +1,310 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_ENVELOPE_H_
+#define ECHIDNA_ENVELOPE_H_
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+namespace echidna
+{
+
+
+// Ogni tipo di evento riceve un indice progressivo la prima volta che viene usato:
+// l'EventBus lo usa per trovare gli handler con un accesso diretto a un vettore.
+inline std::size_t NewEventTypeId()
+{
+    static boost::atomic< std::size_t > last( 0 );
+    return last++;
+}
+
+template < typename E >
+class EventTypeId
+{
+public:
+    static std::size_t Value()
+    {
+        static const std::size_t id = NewEventTypeId();
+        return id;
+    }
+};
+
+
+// Gerarchia degli eventi: la classe base di un evento si dichiara specializzando
+// EventBase (o con la macro ECHIDNA_EVENT_BASE, nel namespace globale).
+// Un handler sottoscritto per la base riceve anche gli eventi derivati.
+struct NoEventBase {};
+
+template < typename E >
+struct EventBase
+{
+    typedef NoEventBase type;
+};
+
+#define ECHIDNA_EVENT_BASE( Derived, Base ) \
+    namespace echidna { template <> struct EventBase< Derived > { typedef Base type; }; }
+
+// EventTypeId di un evento e delle sue basi, a partire dall'evento stesso
+typedef std::vector< std::size_t > EventLineage;
+
+template < typename E >
+class TypeLineage;
+
+// passo di TypeLineage::Upcast dall'evento E alla sua base
+template < typename E, typename Base >
+struct UpcastToBase
+{
+    static const void* Apply( const E* e, std::size_t id )
+    {
+        return TypeLineage< Base >::Upcast( static_cast< const Base* >( e ), id );
+    }
+};
+
+template < typename E >
+struct UpcastToBase< E, NoEventBase >
+{
+    static const void* Apply( const E*, std::size_t ) { return NULL; }
+};
+
+template < typename E >
+class TypeLineage
+{
+public:
+    static const EventLineage& Ids()
+    {
+        static const EventLineage ids = Build();
+        return ids;
+    }
+
+    static void Append( EventLineage& ids )
+    {
+        ids.push_back( EventTypeId< E >::Value() );
+        TypeLineage< typename EventBase< E >::type >::Append( ids );
+    }
+
+    // Ritorna e visto come l'evento con EventTypeId id (NULL se non e' E ne' una sua base).
+    static const void* Upcast( const E* e, std::size_t id )
+    {
+        if ( id == EventTypeId< E >::Value() )
+            return e;
+        return UpcastToBase< E, typename EventBase< E >::type >::Apply( e, id );
+    }
+
+private:
+    static EventLineage Build()
+    {
+        EventLineage ids;
+        Append( ids );
+        return ids;
+    }
+};
+
+template <>
+class TypeLineage< NoEventBase >
+{
+public:
+    static void Append( EventLineage& ) {}
+};
+
+
+// Contiene un evento di tipo qualsiasi (al posto di boost::any).
+// Gli eventi che stanno in InlineSize byte vengono copiati nel buffer interno
+// e non richiedono nessuna allocazione, quelli piu' grandi vanno sull'heap
+// e vengono condivisi dalle copie della busta (un evento imbustato non cambia piu').
+class Envelope
+{
+public:
+
+    enum { InlineSize = 64 };
+
+    Envelope() : ops( NULL ), type( 0 ) {}
+
+    template < typename E >
+    explicit Envelope( const E& e ) :
+        ops( &Ops< E, IsSmall< E >::value >::table ),
+        type( EventTypeId< E >::Value() )
+    {
+        Ops< E, IsSmall< E >::value >::Construct( storage, e );
+    }
+
+    Envelope( const Envelope& other ) :
+        ops( other.ops ),
+        type( other.type )
+    {
+        if ( ops )
+            ops -> copy( other.storage, storage );
+    }
+
+    Envelope& operator=( const Envelope& other )
+    {
+        if ( this != &other )
+        {
+            Clear();
+            if ( other.ops )
+                other.ops -> copy( other.storage, storage );
+            ops = other.ops;
+            type = other.type;
+        }
+        return *this;
+    }
+
+    ~Envelope()
+    {
+        Clear();
+    }
+
+    bool Empty() const { return ops == NULL; }
+
+    // EventTypeId dell'evento contenuto
+    std::size_t Type() const { return type; }
+
+    // Ritorna l'evento contenuto, che deve essere di tipo E.
+    template < typename E >
+    const E& Get() const
+    {
+        assert( !Empty() && type == EventTypeId< E >::Value() );
+        return Ops< E, IsSmall< E >::value >::Get( storage );
+    }
+
+    // Ritorna l'evento contenuto visto come E, che puo' essere il suo tipo
+    // o una sua base (vedi EventBase). NULL se non e' nessuno dei due.
+    template < typename E >
+    const E* As() const
+    {
+        if ( type == EventTypeId< E >::Value() && !Empty() )
+            return &Get< E >();
+        return ops ? static_cast< const E* >( ops -> upcast( storage, EventTypeId< E >::Value() ) ) : NULL;
+    }
+
+    // EventTypeId dell'evento contenuto e delle sue basi
+    const EventLineage& Lineage() const
+    {
+        assert( !Empty() );
+        return ops -> lineage();
+    }
+
+    // indirizzo dell'evento contenuto (del tipo Type())
+    const void* Data() const
+    {
+        assert( !Empty() );
+        return ops -> upcast( storage, type );
+    }
+
+private:
+
+    enum { Alignment = boost::alignment_of< long double >::value };
+
+    union Storage
+    {
+        boost::aligned_storage< InlineSize, Alignment >::type buffer;
+        void* heap;
+    };
+
+    template < typename E >
+    struct IsSmall
+    {
+        static const bool value =
+            sizeof( E ) <= InlineSize &&
+            Alignment % boost::alignment_of< E >::value == 0;
+    };
+
+    // operazioni che dipendono dal tipo dell'evento
+    struct VTable
+    {
+        void ( *copy )( const Storage& from, Storage& to );
+        void ( *destroy )( Storage& s );
+        const void* ( *upcast )( const Storage& s, std::size_t id );
+        const EventLineage& ( *lineage )();
+    };
+
+    template < typename E, bool Small >
+    struct Ops;
+
+    // evento nel buffer interno
+    template < typename E >
+    struct Ops< E, true >
+    {
+        static void Construct( Storage& s, const E& e ) { new ( &s.buffer ) E( e ); }
+        static const E& Get( const Storage& s ) { return *reinterpret_cast< const E* >( &s.buffer ); }
+        static void Copy( const Storage& from, Storage& to ) { Construct( to, Get( from ) ); }
+        static void Destroy( Storage& s ) { reinterpret_cast< E* >( &s.buffer ) -> ~E(); }
+        static const void* Upcast( const Storage& s, std::size_t id ) { return TypeLineage< E >::Upcast( &Get( s ), id ); }
+        static const VTable table;
+    };
+
+    // evento sull'heap, condiviso dalle copie della busta
+    template < typename E >
+    struct Ops< E, false >
+    {
+        struct Shared
+        {
+            explicit Shared( const E& e ) : refs( 1 ), event( e ) {}
+            boost::atomic< unsigned > refs;
+            const E event;
+        };
+        static void Construct( Storage& s, const E& e ) { s.heap = new Shared( e ); }
+        static const E& Get( const Storage& s ) { return static_cast< const Shared* >( s.heap ) -> event; }
+        static void Copy( const Storage& from, Storage& to )
+        {
+            static_cast< Shared* >( from.heap ) -> refs.fetch_add( 1, boost::memory_order_relaxed );
+            to.heap = from.heap;
+        }
+        static void Destroy( Storage& s )
+        {
+            Shared* shared = static_cast< Shared* >( s.heap );
+            if ( shared -> refs.fetch_sub( 1, boost::memory_order_acq_rel ) == 1 )
+                delete shared;
+        }
+        static const void* Upcast( const Storage& s, std::size_t id ) { return TypeLineage< E >::Upcast( &Get( s ), id ); }
+        static const VTable table;
+    };
+
+    void Clear()
+    {
+        if ( ops )
+        {
+            ops -> destroy( storage );
+            ops = NULL;
+        }
+    }
+
+    const VTable* ops;
+    std::size_t type;
+    Storage storage;
+};
+
+template < typename E >
+const Envelope::VTable Envelope::Ops< E, true >::table = { &Copy, &Destroy, &Upcast, &TypeLineage< E >::Ids };
+
+template < typename E >
+const Envelope::VTable Envelope::Ops< E, false >::table = { &Copy, &Destroy, &Upcast, &TypeLineage< E >::Ids };
+
+} // namespace echidna
+
+#endif // ECHIDNA_ENVELOPE_H_
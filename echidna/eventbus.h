@@ -24,258 +24,1790 @@
 #ifndef ECHIDNA_EVENTBUS_H_
 #define ECHIDNA_EVENTBUS_H_
 
-#include <string>
+#include <algorithm>
+#include <cassert>
 #include <map>
-#include <queue>
-#include <typeinfo>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
 #include <boost/function.hpp>
-#include <boost/any.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
+#include <boost/type_traits/remove_cv.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <boost/type_traits/remove_reference.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/utility.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/version.hpp>
+#include <iterator>
+#include "affinity.h"
+#include "backpressure.h"
+#include "conflation.h"
+#include "envelope.h"
+#include "eventqueue.h"
+#include "poller.h"
+#include "priority.h"
+#include "request.h"
+#include "waitstrategy.h"
 
 namespace echidna
 {
 
 
-
 class HandlerFunctionBase
 {
 public:
     virtual ~HandlerFunctionBase() {}
-    virtual void Exec( const boost::any& msg ) = 0;
+    virtual void Exec( const Envelope& msg ) = 0;
 };
 
 
+// L'evento viene passato per riferimento costante all'handler e al predicato:
+// un handler che prende l'evento per riferimento non ne fa nessuna copia,
+// uno che lo prende per valore ne fa solo quella del proprio parametro.
 template < typename E >
 class HandlerFunction : public HandlerFunctionBase
 {
-private:
-    static bool True( E /*e*/ ) { return true; }
 public:
-    typedef boost::function<void (E x)> F;
-    typedef boost::function<bool (E x)> P;
-    HandlerFunction( F _f ) : f( _f ), p( True ) {}
+    typedef typename boost::remove_cv< typename boost::remove_reference< E >::type >::type Event;
+    typedef boost::function<void (const Event& x)> F;
+    typedef boost::function<bool (const Event& x)> P;
+    HandlerFunction( F _f ) : f( _f ) {}
     HandlerFunction( F _f, P _p ) : f( _f ), p( _p ) {}
-    virtual void Exec( const boost::any& msg )
+    // msg puo' contenere un Event o un evento derivato (vedi EventBase)
+    virtual void Exec( const Envelope& msg )
     {
-        try
-        {
-            E e = boost::any_cast< E > ( msg );
-            if ( p( e ) )
-                f( e );
-        }
-        catch ( const boost::bad_any_cast& )
-        {
-            assert( false );
-        }
+        const Event* e = msg.As< Event >();
+        assert( e );
+        if ( p.empty() || p( *e ) )
+            f( *e );
     }
 private:
     F f;
     P p;
 };
 
+// Tipo della chiave di una sottoscrizione (vedi EventBus::SubscribeKey):
+// una stringa letterale o un puntatore a char diventano std::string.
+template < typename K >
+struct SubscriptionKey { typedef K Type; };
+
+template < std::size_t N >
+struct SubscriptionKey< char[ N ] > { typedef std::string Type; };
+
+template < std::size_t N >
+struct SubscriptionKey< const char[ N ] > { typedef std::string Type; };
+
+template <>
+struct SubscriptionKey< char* > { typedef std::string Type; };
 
+template <>
+struct SubscriptionKey< const char* > { typedef std::string Type; };
+
+
+// Di default gli handler vengono eseguiti dal thread che invoca Run/Poll.
+// Se il bus viene costruito con un numero di worker maggiore di zero, gli handler
+// vengono invece eseguiti in parallelo da un pool di thread: chi non e' thread safe
+// puo' sottoscriversi passando uno Strand, e tutti gli handler dello stesso Strand
+// vengono eseguiti uno alla volta, nell'ordine di arrivo degli eventi.
+// Con uno StrandScope si puo' assegnare uno strand a tutte le sottoscrizioni
+// fatte da un thread in un certo intervallo (il Container lo usa per dare
+// a ogni componente la sua mailbox).
+// Un handler sottoscritto per un evento base (vedi EventBase) riceve anche
+// gli eventi derivati: per ogni tipo concreto la lista degli handler da
+// invocare viene calcolata una volta sola, quando cambiano le sottoscrizioni.
+// Le sottoscrizioni con chiave (SubscribeKey) sono raccolte in una hash map:
+// per trovare gli handler interessati basta una ricerca, invece di valutare
+// un predicato per ogni sottoscrizione.
+// La coda e' illimitata, a meno di indicarne la capacita' al costruttore:
+// in quel caso, quando e' piena, Post applica la politica di Backpressure
+// scelta. Con SetCapacity si puo' limitare anche il numero di eventi
+// in coda di un singolo tipo.
+// Con Conflate un evento sostituisce quello dello stesso tipo e con la stessa
+// chiave ancora in coda, cosi' gli handler vedono solo l'ultimo valore.
+// Gli eventi vengono accodati in corsie di priorita' diverse (vedi Priority
+// ed EventPriority) e consegnati a partire dalla corsia piu' alta.
+// Con PostAfter, PostAt e PostEvery un evento viene consegnato a una certa ora:
+// gli eventi programmati vengono consegnati dal thread che invoca Run/Poll,
+// che quando aspetta si risveglia alla prima scadenza.
+// Con Request si invia una richiesta (vedi Query) e si riceve la risposta
+// tramite un future.
 class EventBus : private boost::noncopyable
 {
+public:
+
+    typedef boost::shared_ptr< boost::asio::io_service::strand > StrandPtr;
+    typedef boost::chrono::steady_clock Clock;
+
 private:
 
-    struct Type_info_cmp
+    // numero massimo di eventi prelevati dalla coda in un colpo solo da Poll e Run
+    enum { BatchSize = 256 };
+
+    // Una corsia non vuota scavalcata da quelle piu' alte per StarvationLimit
+    // blocchi di fila viene servita comunque, per un blocco.
+    enum { StarvationLimit = 8 };
+
+    // Mentre aspetta attivamente, il consumatore controlla timer, file descriptor
+    // e budget (che costano piu' della coda) una volta ogni SpinCheck giri.
+    enum { SpinCheck = 64 };
+
+    typedef boost::shared_ptr< HandlerFunctionBase > HandlerPtr;
+
+    class HandlerIndex;
+    typedef boost::shared_ptr< const HandlerIndex > IndexPtr;
+
+    // Un handler, oppure l'indice delle sottoscrizioni con chiave di un tipo
+    struct Handler
     {
-        bool operator()(const std::type_info *t1, const std::type_info *t2) const
-        {
-            return t1->before(*t2) != 0;
-        }
+        Handler( HandlerPtr f, StrandPtr s ) : function( f ), strand( s ) {}
+        explicit Handler( IndexPtr i ) : index( i ) {}
+        HandlerPtr function;
+        StrandPtr strand;
+        IndexPtr index;
     };
 
-    typedef boost::shared_ptr< HandlerFunctionBase > HandlerPtr;
+    typedef std::vector< Handler > HandlerList;
 
-    typedef std::multimap<
-        const std::type_info*,
-        HandlerPtr,
-        Type_info_cmp
-    > Handlers;
+    // Sottoscrizioni con chiave di un tipo di evento, indicizzate con il valore della chiave.
+    // Come la tabella degli handler, un indice pubblicato non viene piu' modificato.
+    class HandlerIndex
+    {
+    public:
+        virtual ~HandlerIndex() {}
+        // handler sottoscritti per la chiave dell'evento (NULL se nessuno)
+        virtual const HandlerList* Match( const Envelope& e ) const = 0;
+        virtual HandlerIndex* Clone() const = 0;
+        // toglie l'handler f, ritorna false se non c'e'
+        virtual bool Remove( const HandlerFunctionBase* f ) = 0;
+        // EventTypeId del tipo della chiave
+        virtual std::size_t KeyType() const = 0;
+    };
 
-    typedef Handlers::iterator It;
+    // Indice degli eventi E con chiave K. Se la funzione che estrae la chiave
+    // e' vuota la chiave e' l'evento stesso (E e K devono coincidere).
+    template < typename E, typename K >
+    class KeyIndex : public HandlerIndex
+    {
+    public:
+        typedef boost::function< K ( const E& ) > KeyFunction;
+        explicit KeyIndex( KeyFunction k ) : key( k ) {}
+        virtual const HandlerList* Match( const Envelope& msg ) const
+        {
+            const E* e = msg.As< E >();
+            assert( e );
+            return Find( *e, boost::is_same< E, K >() );
+        }
+        virtual HandlerIndex* Clone() const { return new KeyIndex( *this ); }
+        virtual bool Remove( const HandlerFunctionBase* f )
+        {
+            for ( typename Map::iterator i = handlers.begin(); i != handlers.end(); ++i )
+                for ( HandlerList::iterator h = i -> second.begin(); h != i -> second.end(); ++h )
+                    if ( h -> function.get() == f )
+                    {
+                        i -> second.erase( h );
+                        if ( i -> second.empty() )
+                            handlers.erase( i );
+                        return true;
+                    }
+            return false;
+        }
+        virtual std::size_t KeyType() const { return EventTypeId< K >::Value(); }
+        void Add( const K& k, const Handler& h ) { handlers[ k ].push_back( h ); }
+    private:
+        typedef boost::unordered_map< K, HandlerList > Map;
+        const HandlerList* Find( const E& e, boost::true_type ) const
+        {
+            return key.empty() ? Lookup( e ) : Lookup( key( e ) );
+        }
+        const HandlerList* Find( const E& e, boost::false_type ) const
+        {
+            return Lookup( key( e ) );
+        }
+        const HandlerList* Lookup( const K& k ) const
+        {
+            typename Map::const_iterator i = handlers.find( k );
+            return i == handlers.end() ? NULL : &i -> second;
+        }
+        KeyFunction key;
+        Map handlers;
+    };
 
-    typedef std::pair< boost::any, const std::type_info* > Entry;
+    // Handler da invocare per ogni tipo concreto di evento (compresi quelli
+    // sottoscritti per le sue basi), indicizzato con EventTypeId
+    typedef std::vector< boost::shared_ptr< const HandlerList > > Handlers;
 
-    Handlers handlers;
-    std::queue< Entry > messages;
+    // Dispatch legge la tabella degli handler senza lock e senza copiarla:
+    // Subscribe e Unsubscribe non la modificano mai, ma ne pubblicano una copia
+    // aggiornata (copy on write). Le tabelle sostituite vengono distrutte
+    // solo quando non c'e' nessun Dispatch in corso (readers == 0).
+    boost::atomic< const Handlers* > handlers;
+    boost::atomic< unsigned > readers;
+    std::vector< const Handlers* > retired;
+    // protetti da handlersMtx:
+    std::vector< HandlerList > subscribed; // handler sottoscritti per ogni tipo, indicizzati con EventTypeId
+    std::vector< const EventLineage* > lineages; // basi dei tipi noti che ne hanno
+    // una coda per ogni livello di Priority
+    boost::scoped_ptr< EventQueue< Envelope > > lanes[ Priority::Levels ];
+    // blocchi consecutivi serviti da corsie piu' alte mentre la corsia aspettava
+    boost::atomic< unsigned > skipped[ Priority::Levels ];
     boost::mutex mtx;
-    boost::mutex handlersMtx;
+    boost::mutex handlersMtx; // serializza le modifiche alla tabella degli handler
     boost::condition_variable cond;
-    bool running;
+    boost::atomic< bool > running; // letto senza lock da Spin
+    // true quando il consumatore sta per addormentarsi su cond:
+    // solo in questo caso Post deve svegliarlo
+    boost::atomic< bool > sleeping;
+    // WaitStrategy del consumatore (il budget in nanosecondi)
+    boost::atomic< int > waitMode;
+    boost::atomic< boost::int_least64_t > waitBudget;
+#ifdef ECHIDNA_HAS_POLLER
+    // creato dal primo Watch: da allora il consumatore aspetta con epoll invece che su cond
+    boost::atomic< Poller* > poller;
+#endif
+
+    // pool di thread che esegue gli handler (se threads > 0)
+    const unsigned threads;
+    boost::asio::io_service io;
+    boost::scoped_ptr< boost::asio::io_service::work > work;
+    boost::thread_group workers;
+
+    // gruppi di thread con un nome (vedi AddWorkerGroup):
+    // eseguono gli handler sottoscritti con uno strand del gruppo
+    struct WorkerGroup : private boost::noncopyable
+    {
+        boost::asio::io_service io;
+        boost::scoped_ptr< boost::asio::io_service::work > work;
+        boost::thread_group workers;
+    };
+    typedef std::map< std::string, boost::shared_ptr< WorkerGroup > > WorkerGroups;
+    WorkerGroups groups; // protetto da groupsMtx
+    boost::mutex groupsMtx;
+    boost::atomic< bool > grouped; // !groups.empty(), letto senza lock
 
-    void Dispatch( Entry e )
+    // evento programmato con PostAfter, PostAt o PostEvery,
+    // oppure azione interna del bus (es. il timeout di Request)
+    struct ScheduledEvent : private boost::noncopyable
     {
-        boost::any m = e.first;
-        const std::type_info* id = e.second;
-        typedef std::pair< It, It > Res;
+        ScheduledEvent( const Envelope& e, Clock::time_point d, Clock::duration p ) :
+            event( e ), deadline( d ), period( p ), cancelled( false ) {}
+        ScheduledEvent( boost::function< void () > a, Clock::time_point d ) :
+            action( a ), deadline( d ), period( Clock::duration::zero() ), cancelled( false ) {}
+        const Envelope event;
+        const boost::function< void () > action; // se c'e', al posto dell'evento
+        Clock::time_point deadline; // protetto da timersMtx
+        const Clock::duration period; // zero se va consegnato una volta sola
+        boost::atomic< bool > cancelled;
+    };
+    typedef boost::shared_ptr< ScheduledEvent > ScheduledPtr;
 
-        std::vector< HandlerPtr > tmp;
+    // funzione accodata con Call: viene eseguita al posto della consegna
+    struct Invocation
+    {
+        explicit Invocation( boost::function< void () > f ) : action( f ) {}
+        boost::function< void () > action;
+    };
 
+    // ordina lo heap degli eventi programmati: in cima c'e' la prima scadenza
+    struct Later
+    {
+        bool operator()( const ScheduledPtr& a, const ScheduledPtr& b ) const
         {
-            boost::lock_guard< boost::mutex > lock( handlersMtx );
-            Res res = handlers.equal_range( id );
-            // si copia gli handler in una lista temporanea (per rilasciare il mtx)
-            for ( It i = res.first; i != res.second; ++i )
-                tmp.push_back( i -> second );
+            return a -> deadline > b -> deadline;
         }
+    };
 
-        // ora può invocare gli handlers (perché ha rilasciato il mtx):
-        std::for_each( tmp.begin(), tmp.end(), boost::bind( &HandlerFunctionBase::Exec, _1, m ) );
-    }
+    std::vector< ScheduledPtr > timers; // heap ordinato con Later
+    boost::mutex timersMtx;
+    boost::atomic< std::size_t > scheduled; // timers.size(), letto senza lock
+
+    // strand dello StrandScope attivo in ogni thread, assegnato alle sue sottoscrizioni
+    boost::thread_specific_ptr< StrandPtr > scopeStrand;
+
+    // backpressure dell'intero bus (usata solo se la coda e' limitata)
+    const bool bounded;
+    const std::size_t capacity;
+    boost::atomic< std::size_t > reserved; // eventi in coda in tutte le corsie (solo se bounded)
+    const Backpressure::Policy policy;
+    BackpressureCounters counters;
 
-    void Unsubscribe( It i )
+    // impostazioni dei singoli tipi di evento
+    struct TypeSettings
     {
-        boost::lock_guard< boost::mutex > lock( handlersMtx );
-        handlers.erase( i );
-    }
+        TypeSettings() : quota( NULL ), conflator( NULL ) {}
+        EventQuota* quota;
+        Conflator* conflator;
+    };
 
-    friend class Subscription;
+    // Tabella delle impostazioni, indicizzata con EventTypeId.
+    // Le tabelle sostituite restano in vita fino alla distruzione del bus,
+    // cosi' Post le puo' leggere senza lock.
+    typedef std::vector< TypeSettings > Settings;
+    boost::atomic< const Settings* > settings;
+    std::vector< const Settings* > retiredSettings;
+    std::vector< boost::shared_ptr< EventQuota > > quotaStore;
+    std::vector< boost::shared_ptr< Conflator > > conflatorStore;
+    boost::atomic< bool > configured; // true se almeno un tipo ha delle impostazioni
 
-public:
+    // i produttori bloccati dalla politica Block aspettano qui
+    boost::mutex spaceMtx;
+    boost::condition_variable spaceCond;
+    boost::atomic< unsigned > blocked;
 
-    class Subscription
+    // Aspetta che ci sia un messaggio in coda o che scada un evento programmato.
+    // Ritorna false se e' stato invocato Stop().
+    bool Wait()
     {
-    public:
-        Subscription() : mb( NULL ) {}
-        void Disconnect() { if ( mb ) mb -> Unsubscribe( i ); }
-    private:
-        Subscription( EventBus* _mb, Handlers::iterator _i ) : mb( _mb ), i( _i ) {}
-        EventBus* mb;
-        Handlers::iterator i;
-        friend class EventBus;
-    };
+        const WaitStrategy::Mode mode = static_cast< WaitStrategy::Mode >( waitMode.load( boost::memory_order_relaxed ) );
+        if ( mode != WaitStrategy::Block &&
+             Spin( mode, boost::chrono::nanoseconds( waitBudget.load( boost::memory_order_relaxed ) ) ) )
+            return true;
 
-    ~EventBus()
+        boost::unique_lock< boost::mutex > lock( mtx );
+
+        while ( running )
+        {
+            if ( !Empty() )
+                return true;
+
+            // prima si dichiara che si sta per dormire, poi si ricontrolla la coda:
+            // un Post concorrente o trova sleeping a true o ha gia' accodato il messaggio
+            // (lo stesso vale per un evento programmato che anticipa la prima scadenza)
+            sleeping = true;
+            // (e simmetricamente che il controllo della coda venga anticipato)
+            boost::atomic_thread_fence( boost::memory_order_seq_cst );
+            const Clock::time_point next = NextDeadline();
+            if ( !Empty() || ( next != Clock::time_point::max() && next <= Clock::now() ) )
+            {
+                sleeping = false;
+                return true;
+            }
+#ifdef ECHIDNA_HAS_POLLER
+            if ( Poller* p = poller.load() )
+            {
+                // gli handler dei file descriptor vengono invocati senza lock
+                lock.unlock();
+                const std::size_t invoked = p -> Wait( next );
+                lock.lock();
+                sleeping = false;
+                if ( invoked > 0 )
+                    return true;
+                continue;
+            }
+#endif
+            if ( next == Clock::time_point::max() )
+                cond.wait( lock );
+            else
+                cond.wait_until( lock, next );
+            sleeping = false;
+        }
+
+        return false; // significa che è stato invocato Stop()
+    }
+
+    // Aspetta attivamente secondo mode. Ritorna true se c'e' qualcosa da gestire,
+    // false se bisogna addormentarsi (o se e' stato invocato Stop).
+    // Intanto sleeping resta false: Post non sveglia nessuno.
+    bool Spin( WaitStrategy::Mode mode, Clock::duration budget )
     {
-        Stop();
+        const Clock::time_point start = Clock::now();
+        bool yielding = false;
+        for ( unsigned i = 1; running; ++i )
+        {
+            if ( !Empty() )
+                return true;
+            if ( yielding || i % SpinCheck == 0 )
+            {
+                const Clock::time_point now = Clock::now();
+                if ( NextDeadline() <= now || PollDescriptors() > 0 )
+                    return true;
+                if ( mode != WaitStrategy::Spin && !yielding && now - start >= budget )
+                {
+                    if ( mode == WaitStrategy::Park )
+                        return false;
+                    yielding = true;
+                }
+            }
+            if ( yielding )
+                boost::this_thread::yield();
+            else
+                CpuRelax();
+        }
+        return false;
     }
 
-    template < typename E >
-    Subscription Subscribe( boost::function<void (E x)> handler )
+    bool Empty() const
     {
-        boost::lock_guard< boost::mutex > lock( handlersMtx );
+        for ( unsigned l = 0; l < Priority::Levels; ++l )
+            if ( !lanes[ l ] -> Empty() )
+                return false;
+        return true;
+    }
 
-        It i =
-            handlers.insert(
-                std::make_pair(
-                    &typeid( E ),
-                    HandlerPtr( new HandlerFunction< E >( handler ) )
-                )
-            );
-        return Subscription( this, i );
+    // Preleva al massimo max eventi da una corsia e li consegna.
+    std::size_t ConsumeLane( unsigned l, std::size_t max )
+    {
+        if ( max == 1 )
+            return lanes[ l ] -> Consume( boost::bind( &EventBus::Deliver, this, _1 ) ) ? 1 : 0;
+        return lanes[ l ] -> ConsumeMany( boost::bind( &EventBus::Deliver, this, _1 ), max );
     }
 
-    template < typename E >
-    Subscription Subscribe( boost::function<void (E x)> handler, boost::function<bool (E x)> predicate )
+    // Consegna al massimo max eventi della corsia piu' alta che ne contiene,
+    // a meno che una corsia piu' bassa non stia aspettando da troppo.
+    // Un evento High aspetta quindi al piu' due blocchi di eventi
+    // gia' prelevati, indipendentemente dalla lunghezza delle altre code.
+    std::size_t PollLanes( std::size_t max )
     {
-        boost::lock_guard< boost::mutex > lock( handlersMtx );
+        for ( unsigned l = 0; l < Priority::Levels; ++l )
+            if ( skipped[ l ].load( boost::memory_order_relaxed ) >= StarvationLimit && !lanes[ l ] -> Empty() )
+            {
+                skipped[ l ].store( 0, boost::memory_order_relaxed );
+                const std::size_t n = ConsumeLane( l, max );
+                if ( n > 0 )
+                    return n;
+            }
+
+        for ( unsigned l = Priority::Levels; l-- > 0; )
+        {
+            const std::size_t n = ConsumeLane( l, max );
+            if ( n == 0 )
+                continue;
+            skipped[ l ].store( 0, boost::memory_order_relaxed );
+            for ( unsigned k = 0; k < l; ++k )
+                if ( !lanes[ k ] -> Empty() )
+                    skipped[ k ].fetch_add( 1, boost::memory_order_relaxed );
+            return n;
+        }
+        return 0;
+    }
 
-        It i =
-            handlers.insert(
-                std::make_pair(
-                    &typeid( E ),
-                    HandlerPtr( new HandlerFunction< E >( handler, predicate ) )
-                )
-            );
-        return Subscription( this, i );
+    // prima scadenza degli eventi programmati (max() se non ce ne sono)
+    Clock::time_point NextDeadline()
+    {
+        if ( scheduled.load( boost::memory_order_relaxed ) == 0 )
+            return Clock::time_point::max();
+        boost::lock_guard< boost::mutex > lock( timersMtx );
+        // un evento annullato non deve risvegliare il consumatore
+        DropCancelled();
+        return timers.empty() ? Clock::time_point::max() : timers.front() -> deadline;
     }
 
-    template < typename E >
-    void Post( E e )
+    // Toglie dalla cima dello heap gli eventi programmati annullati
+    // (quelli piu' in basso vengono tolti quando arrivano in cima).
+    // Va invocata con timersMtx.
+    void DropCancelled()
     {
-        const std::type_info* id = &typeid( E );
+        while ( !timers.empty() && timers.front() -> cancelled )
         {
-            boost::lock_guard< boost::mutex > lock( mtx );
-            messages.push( std::make_pair( e, id ) );
+            std::pop_heap( timers.begin(), timers.end(), Later() );
+            timers.pop_back();
+            --scheduled;
         }
-        cond.notify_one();
     }
 
-    bool PollOne()
+    // Consegna gli eventi programmati gia' scaduti. Ritorna quanti sono.
+    std::size_t FireTimers()
     {
-        Entry e;
+        if ( scheduled.load( boost::memory_order_relaxed ) == 0 )
+            return 0;
 
+        const Clock::time_point now = Clock::now();
+        std::size_t fired = 0;
+        for ( ;; )
         {
-            boost::lock_guard< boost::mutex > lock( mtx );
-            if ( ! messages.empty() )
+            ScheduledPtr s;
             {
-                e = messages.front();
-                messages.pop();
+                boost::lock_guard< boost::mutex > lock( timersMtx );
+                DropCancelled();
+                if ( timers.empty() || timers.front() -> deadline > now )
+                    return fired;
+                std::pop_heap( timers.begin(), timers.end(), Later() );
+                s = timers.back();
+                if ( s -> period == Clock::duration::zero() || s -> cancelled )
+                {
+                    timers.pop_back();
+                    --scheduled;
+                }
+                else
+                {
+                    // se si e' in ritardo di piu' di un periodo, quelli persi non si recuperano
+                    s -> deadline += s -> period;
+                    if ( s -> deadline <= now )
+                        s -> deadline = now + s -> period;
+                    std::push_heap( timers.begin(), timers.end(), Later() );
+                }
+            }
+            // l'handler viene invocato senza lock: puo' programmare altri eventi
+            if ( !s -> cancelled )
+            {
+                if ( s -> action )
+                    s -> action();
+                else
+                    Dispatch( s -> event, false );
+                ++fired;
             }
         }
+    }
 
-        if ( e.first.empty() )
-            return false;
+    // consegna un evento prelevato da una corsia
+    void Deliver( const Envelope& e )
+    {
+        Unreserve();
+        if ( e.Type() == IdOf< ConflatedEvent >() )
+        {
+            const Envelope latest = Resolve( e );
+            Dequeued( latest );
+            Dispatch( latest, false );
+            return;
+        }
+        if ( e.Type() == IdOf< Invocation >() )
+        {
+            e.Get< Invocation >().action();
+            return;
+        }
+        Dequeued( e );
+        Dispatch( e, false );
+    }
+
+    // scarta un evento prelevato da una corsia (politica DropOldest)
+    void Discard( const Envelope& e )
+    {
+        Unreserve();
+        if ( e.Type() == IdOf< ConflatedEvent >() )
+            Dequeued( Resolve( e ) );
+        else if ( e.Type() == IdOf< Invocation >() )
+            // chi l'ha accodata la sta aspettando: la si esegue appena possibile
+            Schedule( ScheduledPtr( new ScheduledEvent( e.Get< Invocation >().action, Clock::now() ) ) );
         else
+            Dequeued( e );
+    }
+
+    // l'ultimo valore che corrisponde a un segnaposto di conflation
+    static Envelope Resolve( const Envelope& e )
+    {
+        const ConflatedEvent& token = e.Get< ConflatedEvent >();
+        return token.owner -> Take( token.slot );
+    }
+
+    // L'evento viene letto direttamente dalla coda, senza copiarlo.
+    // direct e' true per Send (vedi Execute).
+    void Dispatch( const Envelope& e, bool direct )
+    {
+        // finche' reader esiste la tabella letta non puo' essere distrutta,
+        // anche se un handler modifica le sottoscrizioni
+        Reader reader( readers );
+        const Handlers* table = handlers.load();
+        const std::size_t id = e.Type();
+        if ( id >= table -> size() || !( *table )[ id ] )
         {
-            Dispatch( e );
-            return true;
+            // la prima volta che arriva un evento derivato si calcola la sua lista
+            if ( e.Lineage().size() < 2 )
+                return;
+            Learn( e.Lineage() );
+            table = handlers.load();
+        }
+
+        const HandlerList& l = *( *table )[ id ];
+
+        if ( threads == 0 && !grouped )
+        {
+            for ( HandlerList::const_iterator i = l.begin(); i != l.end(); ++i )
+                if ( !i -> index )
+                    i -> function -> Exec( e );
+                else if ( const HandlerList* matched = i -> index -> Match( e ) )
+                    for ( HandlerList::const_iterator m = matched -> begin(); m != matched -> end(); ++m )
+                        m -> function -> Exec( e );
+            return;
         }
+
+        // con il pool gli handler vengono eseguiti dopo che l'evento e' uscito dalla coda:
+        // se ne fa una sola copia, condivisa da tutti gli handler
+        boost::shared_ptr< const Envelope > shared;
+        for ( HandlerList::const_iterator i = l.begin(); i != l.end(); ++i )
+            if ( !i -> index )
+                Execute( *i, e, shared, direct );
+            else if ( const HandlerList* matched = i -> index -> Match( e ) )
+                for ( HandlerList::const_iterator m = matched -> begin(); m != matched -> end(); ++m )
+                    Execute( *m, e, shared, direct );
     }
 
-    void Poll()
+    // Fa eseguire l'handler h dal pool di thread. Con direct gli handler senza strand
+    // vengono eseguiti subito dal thread corrente, quelli con strand con strand::dispatch.
+    // La copia condivisa dell'evento viene fatta solo la prima volta che serve.
+    void Execute( const Handler& h, const Envelope& e, boost::shared_ptr< const Envelope >& shared, bool direct )
     {
-        bool result = true;
-        while ( result )
-            result = PollOne();
+        if ( ( direct && !h.strand ) || !Pooled( h ) )
+        {
+            h.function -> Exec( e );
+            return;
+        }
+        if ( !shared )
+            shared.reset( new Envelope( e ) );
+        const AsyncExec job( h.function, shared );
+        if ( !h.strand )
+            io.post( job );
+        else if ( direct )
+            h.strand -> dispatch( job );
+        else
+            h.strand -> post( job );
     }
 
-    void RunOne()
+    // handler di Bridge: accoda la busta nel bus di destinazione
+    class ForwardFunction : public HandlerFunctionBase
+    {
+    public:
+        ForwardFunction( EventBus& t, Priority::Level l ) : target( t ), level( l ) {}
+        virtual void Exec( const Envelope& msg ) { target.TryPost( msg, level ); }
+    private:
+        EventBus& target;
+        const Priority::Level level;
+    };
+
+    // invocazione di un handler nel pool di thread
+    class AsyncExec
     {
-        Entry e;
+    public:
+        AsyncExec( HandlerPtr f, boost::shared_ptr< const Envelope > e ) : function( f ), event( e ) {}
+        void operator()() const { function -> Exec( *event ); }
+    private:
+        HandlerPtr function;
+        boost::shared_ptr< const Envelope > event;
+    };
 
+    // segnale atteso da Drain: viene aperto dallo strand svuotato
+    class Barrier : private boost::noncopyable
+    {
+    public:
+        Barrier() : open( false ) {}
+        void Open()
+        {
+            // la notifica avviene col lock: Wait non puo' tornare (e distruggere
+            // la barriera) prima che Open abbia finito
+            boost::lock_guard< boost::mutex > lock( mtx );
+            open = true;
+            cond.notify_one();
+        }
+        void Wait()
         {
             boost::unique_lock< boost::mutex > lock( mtx );
-            running = true; // TODO: qui oppure un metodo Reset() apposito?
-
-            while ( messages.empty() && running )
+            while ( !open )
                 cond.wait( lock );
+        }
+    private:
+        boost::mutex mtx;
+        boost::condition_variable cond;
+        bool open;
+    };
+
+    class Reader : private boost::noncopyable
+    {
+    public:
+        explicit Reader( boost::atomic< unsigned >& r ) : readers( r ) { ++readers; }
+        ~Reader() { --readers; }
+    private:
+        boost::atomic< unsigned >& readers;
+    };
+
+    // Sostituisce la tabella degli handler (va invocato con handlersMtx acquisito).
+    void Publish( const Handlers* table )
+    {
+        retired.push_back( handlers.exchange( table ) );
+
+        // se nessuno sta leggendo, i Dispatch successivi vedranno la nuova tabella
+        if ( readers == 0 )
+            DeleteRetired();
+    }
+
+    void DeleteRetired()
+    {
+        for ( std::vector< const Handlers* >::const_iterator i = retired.begin(); i != retired.end(); ++i )
+            delete *i;
+        retired.clear();
+    }
+
+    void Unsubscribe( std::size_t id, const HandlerFunctionBase* f )
+    {
+        boost::lock_guard< boost::mutex > lock( handlersMtx );
+        if ( id >= subscribed.size() )
+            return;
+
+        HandlerList& l = subscribed[ id ];
+        for ( HandlerList::iterator i = l.begin(); i != l.end(); ++i )
+            if ( i -> function.get() == f )
+            {
+                l.erase( i );
+                Republish( id );
+                return;
+            }
+            else if ( i -> index )
+            {
+                HandlerIndex* index = i -> index -> Clone();
+                if ( index -> Remove( f ) )
+                {
+                    i -> index.reset( index );
+                    Republish( id );
+                    return;
+                }
+                delete index;
+            }
+    }
+
+    // indice delle sottoscrizioni con chiave del tipo id, NULL se non c'e'
+    // (va invocato con handlersMtx acquisito)
+    Handler* IndexOf( std::size_t id )
+    {
+        if ( id >= subscribed.size() )
+            return NULL;
+        for ( HandlerList::iterator i = subscribed[ id ].begin(); i != subscribed[ id ].end(); ++i )
+            if ( i -> index )
+                return &*i;
+        return NULL;
+    }
+
+    // Memorizza le basi di un tipo (va invocato con handlersMtx acquisito).
+    void Register( const EventLineage& lineage )
+    {
+        const std::size_t id = lineage.front();
+        if ( lineage.size() < 2 )
+            return;
+        if ( id >= lineages.size() )
+            lineages.resize( id + 1 );
+        lineages[ id ] = &lineage;
+    }
 
-            if ( !running ) return; // significa che è stato invocato Stop()
+    // un tipo derivato arrivato per la prima volta a Dispatch
+    void Learn( const EventLineage& lineage )
+    {
+        boost::lock_guard< boost::mutex > lock( handlersMtx );
+        const std::size_t id = lineage.front();
+        if ( id < lineages.size() && lineages[ id ] )
+            return; // calcolata nel frattempo
+        Register( lineage );
+        Republish( id );
+    }
 
-            e = messages.front();
-            messages.pop();
+    // Lista degli handler da invocare per il tipo concreto id: prima i suoi,
+    // poi quelli delle sue basi (va invocato con handlersMtx acquisito).
+    // Per un tipo derivato la lista esiste anche se e' vuota: cosi' Dispatch
+    // sa che e' gia' stata calcolata.
+    boost::shared_ptr< const HandlerList > Resolve( std::size_t id ) const
+    {
+        const EventLineage* lineage = id < lineages.size() ? lineages[ id ] : NULL;
+        if ( !lineage )
+        {
+            if ( id >= subscribed.size() || subscribed[ id ].empty() )
+                return boost::shared_ptr< const HandlerList >();
+            return boost::shared_ptr< const HandlerList >( new HandlerList( subscribed[ id ] ) );
         }
 
-        assert ( !e.first.empty() );
-        Dispatch( e );
+        HandlerList* l = new HandlerList();
+        for ( EventLineage::const_iterator i = lineage -> begin(); i != lineage -> end(); ++i )
+            if ( *i < subscribed.size() )
+                l -> insert( l -> end(), subscribed[ *i ].begin(), subscribed[ *i ].end() );
+        return boost::shared_ptr< const HandlerList >( l );
     }
 
-    void Run()
+    // Pubblica una tabella con le liste aggiornate del tipo id e dei tipi
+    // noti che derivano da id (va invocato con handlersMtx acquisito).
+    void Republish( std::size_t id )
+    {
+        Handlers* table = new Handlers( *handlers.load() );
+        if ( lineages.size() > table -> size() )
+            table -> resize( lineages.size() );
+        if ( id >= table -> size() )
+            table -> resize( id + 1 );
+        ( *table )[ id ] = Resolve( id );
+        for ( std::size_t t = 0; t < lineages.size(); ++t )
+            if ( t != id && lineages[ t ] && std::find( lineages[ t ] -> begin(), lineages[ t ] -> end(), id ) != lineages[ t ] -> end() )
+                ( *table )[ t ] = Resolve( t );
+        Publish( table );
+    }
+
+    // NULL se il tipo non ha impostazioni
+    const TypeSettings* SettingsOf( std::size_t id ) const
+    {
+        if ( !configured.load( boost::memory_order_acquire ) )
+            return NULL;
+        const Settings& table = *settings.load( boost::memory_order_acquire );
+        return id < table.size() ? &table[ id ] : NULL;
+    }
+
+    // NULL se il tipo non ha una quota
+    EventQuota* QuotaOf( std::size_t id ) const
+    {
+        const TypeSettings* s = SettingsOf( id );
+        return s ? s -> quota : NULL;
+    }
+
+    // Pubblica una nuova tabella con le impostazioni del tipo id modificate
+    // (va invocato con handlersMtx acquisito).
+    void Configure( std::size_t id, const TypeSettings& s )
     {
-        Entry e;
+        Settings* table = new Settings( *settings.load() );
+        if ( id >= table -> size() )
+            table -> resize( id + 1 );
+        ( *table )[ id ] = s;
+        retiredSettings.push_back( settings.exchange( table ) );
+        configured = true;
+    }
+
+    // impostazioni attuali del tipo id (va invocato con handlersMtx acquisito)
+    TypeSettings CurrentSettings( std::size_t id ) const
+    {
+        const Settings& table = *settings.load();
+        return id < table.size() ? table[ id ] : TypeSettings();
+    }
 
+    // l'evento e' uscito dalla coda: libera il suo posto nella quota del tipo
+    void Dequeued( const Envelope& e )
+    {
+        if ( EventQuota* quota = QuotaOf( e.Type() ) )
+            quota -> Release();
+    }
+
+    // Riserva un posto nella quota del tipo. Ritorna false se l'evento va scartato.
+    bool Acquire( EventQuota& quota )
+    {
+        bool counted = false;
+        while ( !quota.TryAcquire() )
         {
-            boost::unique_lock< boost::mutex > lock( mtx );
-            running = true; // TODO: qui oppure un metodo Reset() apposito?
+            const Backpressure::Policy p = quota.policy;
+            if ( !counted )
+            {
+                quota.counters.Count( p );
+                counted = true;
+            }
+            if ( p != Backpressure::Block )
+                return false;
 
-            while ( messages.empty() && running )
-                cond.wait( lock );
+            boost::unique_lock< boost::mutex > lock( spaceMtx );
+            ++blocked;
+            while ( quota.Full() )
+                spaceCond.wait( lock );
+            --blocked;
+        }
+        return true;
+    }
+
+    // Accoda l'evento nella corsia level applicando conflation e politiche di backpressure.
+    // Ritorna false se l'evento e' stato scartato.
+    template < typename E >
+    bool Enqueue( const E& e, Priority::Level level )
+    {
+        return Enqueue( e, IdOf< E >(), &e, level );
+    }
+
+    // come sopra, per un evento gia' imbustato
+    bool Enqueue( const Envelope& e, Priority::Level level )
+    {
+        return Enqueue( e, e.Type(), e.Data(), level );
+    }
+
+    // x e' l'evento (o la sua busta), id il suo EventTypeId, event il suo indirizzo
+    template < typename T >
+    bool Enqueue( const T& x, std::size_t id, const void* event, Priority::Level level )
+    {
+        const TypeSettings* s = SettingsOf( id );
+        if ( !s || !s -> conflator )
+            return Enqueue( x, s ? s -> quota : NULL, level );
+
+        ConflatedEvent token;
+        if ( !s -> conflator -> Offer( event, token ) )
+            return true; // ha sostituito l'evento con la stessa chiave gia' in coda
+        if ( Enqueue( token, s -> quota, level ) )
+            return true;
+        s -> conflator -> Take( token.slot );
+        return false;
+    }
+
+    // Accoda x nella corsia level applicando le politiche di backpressure
+    // (quota e' quella del tipo di evento, se c'e').
+    template < typename T >
+    bool Enqueue( const T& x, EventQuota* quota, Priority::Level level )
+    {
+        if ( quota && !Acquire( *quota ) )
+            return false;
+
+        if ( bounded && !Reserve() )
+        {
+            // il bus e' pieno
+            switch ( policy )
+            {
+                case Backpressure::Block:
+                {
+                    counters.Count( policy );
+                    boost::unique_lock< boost::mutex > lock( spaceMtx );
+                    ++blocked;
+                    while ( !Reserve() )
+                        spaceCond.wait( lock );
+                    --blocked;
+                    break;
+                }
+                case Backpressure::DropOldest:
+                    while ( !Reserve() )
+                        // se un consumatore ha gia' prelevato gli eventi in testa
+                        // ma non li ha ancora consegnati si riprova
+                        if ( DropOldestEvent() )
+                            counters.Count( policy );
+                        else
+                            boost::this_thread::yield();
+                    break;
+                default: // Fail, DropNewest
+                    counters.Count( policy );
+                    if ( quota )
+                        quota -> Release();
+                    return false;
+            }
+        }
 
-            if ( !running ) return; // significa che è stato invocato Stop()
+        // l'evento viene copiato una sola volta, direttamente nella coda
+        lanes[ level ] -> Push( x );
+        return true;
+    }
 
-            e = messages.front();
-            messages.pop();
+    // Prenota un posto nel bus: il limite vale per tutte le corsie insieme.
+    bool Reserve()
+    {
+        std::size_t n = reserved.load();
+        do
+        {
+            if ( n >= capacity )
+                return false;
         }
+        while ( !reserved.compare_exchange_weak( n, n + 1 ) );
+        return true;
+    }
 
-        assert ( !e.first.empty() );
-        Dispatch( e );
+    // libera il posto di un evento prelevato da una corsia
+    void Unreserve()
+    {
+        if ( bounded )
+            reserved.fetch_sub( 1 );
+    }
 
-        // controllo se ho messo qualcosa:
-        Poll();
+    // Scarta l'evento in testa alla corsia di priorita' piu' bassa che
+    // ne contiene (politica DropOldest). Ritorna false se non ne ha trovati.
+    bool DropOldestEvent()
+    {
+        for ( unsigned l = 0; l < Priority::Levels; ++l )
+            if ( lanes[ l ] -> Consume( boost::bind( &EventBus::Discard, this, _1 ) ) )
+                return true;
+        return false;
     }
 
-    void Stop()
+    // sveglia i produttori bloccati, se ce ne sono
+    void NotifySpace()
     {
+        boost::atomic_thread_fence( boost::memory_order_seq_cst );
+        if ( blocked )
         {
-            boost::lock_guard< boost::mutex > lock( mtx );
-            running = false;
+            boost::lock_guard< boost::mutex > lock( spaceMtx );
+            spaceCond.notify_all();
+        }
+    }
+
+    // l'indice non deve dipendere da come e' stato scritto il tipo (es. const E&)
+    template < typename E >
+    static std::size_t IdOf()
+    {
+        typedef typename boost::remove_cv< typename boost::remove_reference< E >::type >::type T;
+        return EventTypeId< T >::Value();
+    }
+
+    friend class Subscription;
+
+public:
+
+    class Subscription
+    {
+    public:
+        Subscription() : mb( NULL ), id( 0 ), f( NULL ) {}
+        void Disconnect() { if ( mb ) mb -> Unsubscribe( id, f ); }
+    private:
+        Subscription( EventBus* _mb, std::size_t _id, const HandlerFunctionBase* _f ) : mb( _mb ), id( _id ), f( _f ) {}
+        EventBus* mb;
+        std::size_t id;
+        const HandlerFunctionBase* f;
+        friend class EventBus;
+    };
+
+private:
+
+    Subscription Insert( const EventLineage& lineage, HandlerPtr f, StrandPtr s )
+    {
+        const std::size_t id = lineage.front();
+        boost::lock_guard< boost::mutex > lock( handlersMtx );
+        if ( !s )
+            s = ScopedStrand();
+        Register( lineage );
+        if ( id >= subscribed.size() )
+            subscribed.resize( id + 1 );
+        subscribed[ id ].push_back( Handler( f, s ) );
+        Republish( id );
+        return Subscription( this, id, f.get() );
+    }
+
+    template < typename E, typename K >
+    Subscription InsertKey( const K& value, HandlerPtr f, StrandPtr s )
+    {
+        typedef typename HandlerFunction< E >::Event Event;
+        const EventLineage& lineage = LineageOf< E >();
+        const std::size_t id = lineage.front();
+        boost::lock_guard< boost::mutex > lock( handlersMtx );
+        if ( !s )
+            s = ScopedStrand();
+
+        KeyIndex< Event, K >* index;
+        if ( Handler* h = IndexOf( id ) )
+        {
+            if ( h -> index -> KeyType() != EventTypeId< K >::Value() )
+                throw std::invalid_argument( "SubscribeKey: key type differs from the one given to IndexBy" );
+            index = static_cast< KeyIndex< Event, K >* >( h -> index -> Clone() );
+            h -> index.reset( index );
+        }
+        else
+        {
+            // senza IndexBy la chiave e' l'evento stesso
+            if ( !boost::is_same< Event, K >::value )
+                throw std::logic_error( "SubscribeKey: IndexBy must be invoked first for this event type" );
+            Register( lineage );
+            if ( id >= subscribed.size() )
+                subscribed.resize( id + 1 );
+            index = new KeyIndex< Event, K >( typename KeyIndex< Event, K >::KeyFunction() );
+            subscribed[ id ].push_back( Handler( IndexPtr( index ) ) );
+        }
+        // l'indice non e' ancora pubblicato: si puo' ancora modificare
+        index -> Add( value, Handler( f, s ) );
+        Republish( id );
+        return Subscription( this, id, f.get() );
+    }
+
+    template < typename Req, typename Rep >
+    static void Answer( const boost::function< Rep ( const Req& ) >& f, const Query< Req, Rep >& q )
+    {
+        try
+        {
+            q.Reply( f( q.Request() ) );
+        }
+        catch ( ... )
+        {
+            q.Fail( boost::current_exception() );
+        }
+    }
+
+    template < typename E >
+    static const EventLineage& LineageOf()
+    {
+        return TypeLineage< typename HandlerFunction< E >::Event >::Ids();
+    }
+
+    void Work()
+    {
+        io.run();
+    }
+
+    static void WorkOn( boost::asio::io_service* service )
+    {
+        service -> run();
+    }
+
+    // true se h va eseguito da un thread del pool o di un gruppo
+    bool Pooled( const Handler& h ) const
+    {
+        return Pooled( h.strand );
+    }
+
+    static boost::asio::io_service& ServiceOf( boost::asio::io_service::strand& s )
+    {
+#if BOOST_VERSION >= 106600
+        return s.context();
+#else
+        return s.get_io_service();
+#endif
+    }
+
+    void Wake()
+    {
+        // Il lock serve solo se il consumatore sta dormendo (o sta per farlo).
+        // La barriera impedisce che la lettura di sleeping venga anticipata
+        // rispetto alla scrittura in coda.
+        boost::atomic_thread_fence( boost::memory_order_seq_cst );
+        if ( sleeping )
+        {
+            boost::lock_guard< boost::mutex > lock( mtx );
+            cond.notify_one();
+#ifdef ECHIDNA_HAS_POLLER
+            if ( Poller* p = poller.load() )
+                p -> Wake();
+#endif
+        }
+    }
+
+    // gestisce i file descriptor pronti, senza aspettare
+    std::size_t PollDescriptors()
+    {
+#ifdef ECHIDNA_HAS_POLLER
+        if ( Poller* p = poller.load( boost::memory_order_acquire ) )
+            return p -> Poll();
+#endif
+        return 0;
+    }
+
+public:
+
+    // Permette di annullare un evento programmato.
+    class Timer
+    {
+    public:
+        Timer() {}
+        // l'evento non viene piu' consegnato (se la consegna e' in corso, termina)
+        void Cancel() { if ( event ) event -> cancelled = true; }
+        // come Cancel, ma la funzione ritornata non tiene in vita il timer
+        // (es. per annullare il timeout di una richiesta quando arriva la risposta)
+        boost::function< void () > Canceller() const
+        {
+            return boost::bind( &EventBus::CancelTimer, boost::weak_ptr< ScheduledEvent >( event ) );
+        }
+    private:
+        explicit Timer( ScheduledPtr e ) : event( e ) {}
+        ScheduledPtr event;
+        friend class EventBus;
+    };
+
+private:
+
+    template < typename E >
+    Timer Schedule( const E& e, Clock::time_point deadline, Clock::duration period )
+    {
+        return Schedule( ScheduledPtr( new ScheduledEvent( Envelope( e ), deadline, period ) ) );
+    }
+
+    // il timer tiene in vita la richiesta, non viceversa (vedi Request)
+    static void CancelTimer( const boost::weak_ptr< ScheduledEvent >& timer )
+    {
+        if ( const ScheduledPtr s = timer.lock() )
+            s -> cancelled = true;
+    }
+
+    Timer Schedule( const ScheduledPtr& s )
+    {
+        bool first;
+        {
+            boost::lock_guard< boost::mutex > lock( timersMtx );
+            timers.push_back( s );
+            std::push_heap( timers.begin(), timers.end(), Later() );
+            ++scheduled;
+            first = ( timers.front() == s );
+        }
+        // il consumatore addormentato deve ricalcolare la scadenza
+        if ( first )
+            Wake();
+        return Timer( s );
+    }
+
+public:
+
+    // Finche' l'oggetto esiste, le sottoscrizioni fatte dal thread corrente
+    // senza indicare uno strand usano quello passato al costruttore.
+    class StrandScope : private boost::noncopyable
+    {
+    public:
+        // lo scope e' del solo thread corrente: gli scope aperti da altri thread
+        // (anche sullo stesso bus) non lo vedono e non lo modificano
+        StrandScope( EventBus& _bus, StrandPtr strand ) : bus( _bus ), prev( bus.scopeStrand.release() )
+        {
+            bus.scopeStrand.reset( new StrandPtr( strand ) );
+        }
+        ~StrandScope()
+        {
+            bus.scopeStrand.reset( prev );
+        }
+    private:
+        EventBus& bus;
+        StrandPtr* prev;
+    };
+
+    // strand dello StrandScope attivo nel thread corrente (vuoto se non ce n'e')
+    StrandPtr ScopedStrand() const
+    {
+        const StrandPtr* strand = scopeStrand.get();
+        return strand ? *strand : StrandPtr();
+    }
+
+    // true se gli handler sottoscritti con strand vengono eseguiti da un pool di thread;
+    // altrimenti li esegue il thread che invoca Run/Poll e lo strand viene ignorato
+    bool Pooled( const StrandPtr& strand ) const
+    {
+        return threads > 0 || ( strand && &ServiceOf( *strand ) != &io );
+    }
+
+    // Aspetta che il pool abbia eseguito gli handler gia' accodati nello strand.
+    // Va invocato dopo il Disconnect delle sottoscrizioni di un oggetto che usa
+    // lo strand, prima di distruggerlo: altrimenti un thread del pool potrebbe
+    // eseguire i suoi handler dopo la distruzione. Non aspetta se lo strand non
+    // e' eseguito da un pool, se i suoi thread sono gia' terminati (vedi Join)
+    // o se viene invocato da un handler dello strand stesso.
+    void Drain( const StrandPtr& strand )
+    {
+        if ( !strand || !Pooled( strand ) || strand -> running_in_this_thread() || ServiceOf( *strand ).stopped() )
+            return;
+        Barrier barrier;
+        strand -> post( boost::bind( &Barrier::Open, &barrier ) );
+        barrier.Wait();
+    }
+
+    // threads e' il numero di thread che eseguono gli handler:
+    // con 0 gli handler vengono eseguiti dal thread che invoca Run/Poll.
+    // capacity e' il numero massimo di eventi in coda nell'intero bus, sommando
+    // tutte le corsie di priorita' (0 = illimitato); quando il bus e' pieno
+    // Post si comporta secondo _policy. Con DropOldest viene scartato l'evento
+    // piu' vecchio della corsia di priorita' piu' bassa che ne contiene.
+    // Attenzione: con Block, un Post invocato dal thread che consuma la coda
+    // (es. da un handler con threads == 0) resta bloccato per sempre.
+    explicit EventBus( unsigned _threads = 0, std::size_t _capacity = 0, Backpressure::Policy _policy = Backpressure::Block ) :
+        handlers( new Handlers() ),
+        readers( 0 ),
+        running( true ),
+        sleeping( false ),
+        waitMode( WaitStrategy::Block ),
+        waitBudget( 0 ),
+        threads( _threads ),
+        grouped( false ),
+        scheduled( 0 ),
+        bounded( _capacity > 0 ),
+        capacity( _capacity ),
+        reserved( 0 ),
+        policy( _policy ),
+        settings( new Settings() ),
+        configured( false ),
+        blocked( 0 )
+    {
+        for ( unsigned l = 0; l < Priority::Levels; ++l )
+        {
+            // il limite e' imposto da Reserve: le corsie non rifiutano mai un evento
+            // (un evento in consegna occupa ancora la cella anche se il suo posto
+            // e' gia' stato liberato, e in quel caso finisce nell'overflow)
+            lanes[ l ].reset( new EventQueue< Envelope >( bounded ? capacity : 1024 ) );
+            skipped[ l ] = 0;
+        }
+#ifdef ECHIDNA_HAS_POLLER
+        poller = NULL;
+#endif
+        if ( threads > 0 )
+        {
+            work.reset( new boost::asio::io_service::work( io ) );
+            for ( unsigned i = 0; i < threads; ++i )
+                workers.create_thread( boost::bind( &EventBus::Work, this ) );
+        }
+    }
+
+    ~EventBus()
+    {
+        Stop();
+        Join();
+        // le richieste rimaste in coda avvisano chi le aspetta (vedi QueryState::OnDone),
+        // che puo' programmare altre azioni: vanno distrutte prima dei timer
+        for ( int l = 0; l < Priority::Levels; ++l )
+            lanes[ l ].reset();
+        DeleteRetired();
+        delete handlers.load();
+        for ( std::vector< const Settings* >::const_iterator i = retiredSettings.begin(); i != retiredSettings.end(); ++i )
+            delete *i;
+        delete settings.load();
+#ifdef ECHIDNA_HAS_POLLER
+        delete poller.load();
+#endif
+    }
+
+    // Crea un nuovo strand: gli handler sottoscritti con lo stesso strand
+    // non vengono mai eseguiti in parallelo tra loro.
+    StrandPtr NewStrand()
+    {
+        return StrandPtr( new boost::asio::io_service::strand( io ) );
+    }
+
+    // Crea uno strand del gruppo di thread name (vedi AddWorkerGroup):
+    // gli handler sottoscritti con questo strand vengono eseguiti da quei thread.
+    StrandPtr NewStrand( const std::string& group )
+    {
+        boost::lock_guard< boost::mutex > lock( groupsMtx );
+        const WorkerGroups::const_iterator g = groups.find( group );
+        if ( g == groups.end() )
+            throw std::invalid_argument( "unknown worker group " + group );
+        return StrandPtr( new boost::asio::io_service::strand( g -> second -> io ) );
+    }
+
+    // Aggiunge un gruppo di size thread legati alle CPU cpus (vuoto = tutte),
+    // separato dal pool del bus: gli handler dei componenti piu' caldi possono
+    // girare sempre sulle stesse CPU (vedi NewStrand). Anche con threads == 0
+    // nel costruttore, gli handler con uno strand del gruppo vengono eseguiti dai suoi thread.
+    void AddWorkerGroup( const std::string& name, unsigned size, const CpuSet& cpus = CpuSet() )
+    {
+        if ( size == 0 )
+            throw std::invalid_argument( "worker group " + name + " needs at least one thread" );
+        boost::lock_guard< boost::mutex > lock( groupsMtx );
+        if ( groups.find( name ) != groups.end() )
+            throw std::invalid_argument( "duplicate worker group " + name );
+        const boost::shared_ptr< WorkerGroup > g( new WorkerGroup() );
+        g -> work.reset( new boost::asio::io_service::work( g -> io ) );
+        // i thread del gruppo ereditano l'affinita' del thread che li crea
+        ScopedAffinity pinned( cpus );
+        if ( !pinned.Pinned() )
+            throw std::invalid_argument( "cannot bind worker group " + name + " to its cpus" );
+        for ( unsigned i = 0; i < size; ++i )
+            g -> workers.create_thread( boost::bind( &EventBus::WorkOn, &g -> io ) );
+        groups[ name ] = g;
+        grouped = true;
+    }
+
+    template < typename E >
+    Subscription Subscribe( typename HandlerFunction< E >::F handler )
+    {
+        return Insert( LineageOf< E >(), HandlerPtr( new HandlerFunction< E >( handler ) ), StrandPtr() );
+    }
+
+    template < typename E >
+    Subscription Subscribe( typename HandlerFunction< E >::F handler, StrandPtr strand )
+    {
+        return Insert( LineageOf< E >(), HandlerPtr( new HandlerFunction< E >( handler ) ), strand );
+    }
+
+    template < typename E >
+    Subscription Subscribe( typename HandlerFunction< E >::F handler, typename HandlerFunction< E >::P predicate )
+    {
+        return Insert( LineageOf< E >(), HandlerPtr( new HandlerFunction< E >( handler, predicate ) ), StrandPtr() );
+    }
+
+    template < typename E >
+    Subscription Subscribe( typename HandlerFunction< E >::F handler, typename HandlerFunction< E >::P predicate, StrandPtr strand )
+    {
+        return Insert( LineageOf< E >(), HandlerPtr( new HandlerFunction< E >( handler, predicate ) ), strand );
+    }
+
+    // Limita a capacity il numero di eventi di tipo E in coda. Quando
+    // la quota e' esaurita Post si comporta secondo policy, che non puo'
+    // essere DropOldest (un evento in mezzo alla coda non si puo' togliere).
+    template < typename E >
+    void SetCapacity( std::size_t capacity, Backpressure::Policy policy )
+    {
+        if ( policy == Backpressure::DropOldest )
+            throw std::invalid_argument( "DropOldest is not supported for a single event type" );
+
+        const std::size_t id = IdOf< E >();
+        boost::lock_guard< boost::mutex > lock( handlersMtx );
+        TypeSettings s = CurrentSettings( id );
+        if ( s.quota )
+        {
+            s.quota -> policy = policy;
+            s.quota -> capacity = capacity;
+        }
+        else
+        {
+            boost::shared_ptr< EventQuota > quota( new EventQuota( capacity, policy ) );
+            quotaStore.push_back( quota );
+            s.quota = quota.get();
+            Configure( id, s );
+        }
+        // con una capacita' maggiore qualche produttore potrebbe ripartire
+        NotifySpace();
+    }
+
+    // Le sottoscrizioni con chiave degli eventi di tipo E (vedi SubscribeKey)
+    // confrontano il loro valore con key( evento ). Va invocato prima di SubscribeKey,
+    // una volta sola per tipo; non serve se la chiave e' l'evento stesso (es. std::string).
+    template < typename E, typename K >
+    void IndexBy( boost::function< K ( const typename HandlerFunction< E >::Event& ) > key )
+    {
+        typedef typename HandlerFunction< E >::Event Event;
+        const EventLineage& lineage = LineageOf< E >();
+        const std::size_t id = lineage.front();
+        boost::lock_guard< boost::mutex > lock( handlersMtx );
+        if ( IndexOf( id ) )
+            throw std::logic_error( "IndexBy already invoked for this event type" );
+        Register( lineage );
+        if ( id >= subscribed.size() )
+            subscribed.resize( id + 1 );
+        subscribed[ id ].push_back( Handler( IndexPtr( new KeyIndex< Event, K >( key ) ) ) );
+        Republish( id );
+    }
+
+    // L'handler viene invocato solo per gli eventi la cui chiave e' uguale a value.
+    // Le sottoscrizioni con chiave si possono usare insieme a quelle con predicato,
+    // che restano per le condizioni arbitrarie.
+    // Una stringa letterale viene confrontata come std::string (vedi SubscriptionKey).
+    template < typename E, typename K >
+    Subscription SubscribeKey( const K& value, typename HandlerFunction< E >::F handler )
+    {
+        typedef typename SubscriptionKey< K >::Type Key;
+        return InsertKey< E, Key >( value, HandlerPtr( new HandlerFunction< E >( handler ) ), StrandPtr() );
+    }
+
+    template < typename E, typename K >
+    Subscription SubscribeKey( const K& value, typename HandlerFunction< E >::F handler, StrandPtr strand )
+    {
+        typedef typename SubscriptionKey< K >::Type Key;
+        return InsertKey< E, Key >( value, HandlerPtr( new HandlerFunction< E >( handler ) ), strand );
+    }
+
+    // Da questo momento un evento di tipo E postato quando in coda ce n'e'
+    // gia' uno con la stessa chiave lo sostituisce, mantenendone la posizione:
+    // gli handler ricevono solo l'ultimo valore. Si invoca una volta sola per tipo.
+    template < typename E, typename K >
+    void Conflate( typename KeyConflator< typename HandlerFunction< E >::Event, K >::KeyFunction key )
+    {
+        typedef typename HandlerFunction< E >::Event Event;
+        const std::size_t id = IdOf< E >();
+        boost::lock_guard< boost::mutex > lock( handlersMtx );
+        TypeSettings s = CurrentSettings( id );
+        if ( s.conflator )
+            throw std::logic_error( "Conflate already invoked for this event type" );
+        boost::shared_ptr< Conflator > conflator( new KeyConflator< Event, K >( key ) );
+        conflatorStore.push_back( conflator );
+        s.conflator = conflator.get();
+        Configure( id, s );
+    }
+
+    // quante volte sono scattate le politiche di backpressure dell'intero bus
+    BackpressureStats Stats() const
+    {
+        return counters.Get();
+    }
+
+    // quante volte sono scattate le politiche di backpressure della quota di E
+    template < typename E >
+    BackpressureStats Stats() const
+    {
+        const EventQuota* quota = QuotaOf( IdOf< E >() );
+        return quota ? quota -> counters.Get() : BackpressureStats();
+    }
+
+    // Inoltra al bus target gli eventi di tipo E (o derivati) consegnati da questo bus,
+    // con la priorita' di E. Viene accodata la busta dell'evento, senza ricostruirlo:
+    // gli eventi grandi non vengono copiati (vedi Envelope). Nel bus target valgono
+    // le sue quote e la sua conflation. Il ponte resta attivo finche' non si invoca
+    // Disconnect sulla sottoscrizione, e target deve esistere finche' e' attivo.
+    // Con il pool di thread il ponte ha un suo strand: gli eventi arrivano
+    // nel bus target nell'ordine in cui sono stati consegnati.
+    // Non si deve creare anche il ponte inverso (da target a questo bus) per E,
+    // per un suo tipo base o derivato: ogni evento verrebbe inoltrato all'infinito.
+    template < typename E >
+    Subscription Bridge( EventBus& target )
+    {
+        typedef typename HandlerFunction< E >::Event Event;
+        return Insert( LineageOf< E >(), HandlerPtr( new ForwardFunction( target, EventPriority< Event >::value ) ), NewStrand() );
+    }
+
+    // Invoca gli handler di e dal thread corrente, senza passare dalla coda
+    // (e quindi senza priorita', quote e conflation), usando la stessa tabella
+    // degli handler di Post. Gli handler possono modificare le sottoscrizioni come
+    // con Post; se invocano Send, l'evento annidato viene consegnato prima di ritornare.
+    // Con il pool di thread, un handler con uno strand viene eseguito subito solo
+    // se il thread corrente e' gia' nello strand, altrimenti viene accodato allo strand.
+    template < typename E >
+    void Send( const E& e )
+    {
+        // per gli eventi piccoli la busta non richiede allocazioni
+        Dispatch( Envelope( e ), true );
+    }
+
+    // l'evento viene accodato con la priorita' del suo tipo (vedi EventPriority)
+    template < typename E >
+    void Post( const E& e )
+    {
+        TryPost( e, EventPriority< E >::value );
+    }
+
+    template < typename E >
+    void Post( const E& e, Priority::Level level )
+    {
+        TryPost( e, level );
+    }
+
+    // Come Post, ma ritorna false se l'evento e' stato scartato
+    // (politiche Fail e DropNewest).
+    template < typename E >
+    bool TryPost( const E& e )
+    {
+        return TryPost( e, EventPriority< E >::value );
+    }
+
+    template < typename E >
+    bool TryPost( const E& e, Priority::Level level )
+    {
+        if ( !Enqueue( e, level ) )
+            return false;
+        Wake();
+        return true;
+    }
+
+    // Accoda un evento gia' imbustato (es. da un altro bus): come TryPost
+    // dell'evento contenuto, ma per gli eventi grandi senza copiarlo.
+    bool TryPost( const Envelope& e, Priority::Level level )
+    {
+        assert( !e.Empty() );
+        if ( !Enqueue( e, level ) )
+            return false;
+        Wake();
+        return true;
+    }
+
+    // Consegna l'evento dopo delay.
+    template < typename E >
+    Timer PostAfter( const E& e, Clock::duration delay )
+    {
+        return Schedule( e, Clock::now() + delay, Clock::duration::zero() );
+    }
+
+    // Consegna l'evento all'istante deadline.
+    template < typename E >
+    Timer PostAt( const E& e, Clock::time_point deadline )
+    {
+        return Schedule( e, deadline, Clock::duration::zero() );
+    }
+
+    // Consegna l'evento ogni period (la prima volta dopo period), finche'
+    // non si invoca Cancel sul Timer ritornato.
+    template < typename E >
+    Timer PostEvery( const E& e, Clock::duration period )
+    {
+        if ( period <= Clock::duration::zero() )
+            throw std::invalid_argument( "PostEvery requires a positive period" );
+        return Schedule( e, Clock::now() + period, period );
+    }
+
+#ifdef ECHIDNA_HAS_POLLER
+    // Solo su Linux: quando fd e' pronto (events e' una combinazione di Poller::Readable
+    // e Poller::Writable) handler viene invocato dal thread che esegue Run/Poll,
+    // senza passare dalla coda. Dal primo Watch, Run aspetta con epoll sia i file
+    // descriptor sia i Post (segnalati con un eventfd): un solo thread puo' gestire
+    // eventi e I/O. Le scadenze degli eventi programmati hanno allora la risoluzione
+    // del millisecondo. Si puo' invocare di nuovo per cambiare events o handler.
+    void Watch( int fd, unsigned events, Poller::Handler handler )
+    {
+        Poller* p;
+        {
+            boost::lock_guard< boost::mutex > lock( mtx );
+            p = poller.load();
+            if ( !p )
+            {
+                p = new Poller();
+                poller.store( p, boost::memory_order_release );
+            }
+            // chi aspetta su cond ricomincia con epoll
+            cond.notify_one();
+        }
+        p -> Add( fd, events, handler );
+    }
+
+    // Dopo Unwatch l'handler di fd non viene piu' invocato (va invocato prima di chiudere fd).
+    void Unwatch( int fd )
+    {
+        if ( Poller* p = poller.load( boost::memory_order_acquire ) )
+            p -> Remove( fd );
+    }
+
+#endif
+    // Come il thread che esegue Run/RunOne aspetta gli eventi (vedi WaitStrategy):
+    // con le modalita' attive risponde prima e Post non deve svegliarlo,
+    // ma occupa il processore mentre aspetta. Non riguarda il pool di thread.
+    // Si puo' cambiare in ogni momento: vale dall'attesa successiva.
+    void SetWaitStrategy( const WaitStrategy& strategy )
+    {
+        waitBudget.store( boost::chrono::duration_cast< boost::chrono::nanoseconds >( strategy.budget ).count(),
+            boost::memory_order_relaxed );
+        waitMode.store( strategy.mode, boost::memory_order_relaxed );
+    }
+
+    // Esegue f dal thread che esegue Run/Poll, dopo gli eventi gia' accodati
+    // con priorita' Normal (con il pool di thread, dopo averli passati al pool).
+    // Come TryPost, ritorna false se la coda e' piena (politiche Fail e DropNewest).
+    bool Call( boost::function< void () > f )
+    {
+        if ( !Enqueue( Invocation( f ), NULL, Priority::Normal ) )
+            return false;
+        Wake();
+        return true;
+    }
+
+    // Esegue f dal thread che esegue Run/Poll dopo delay,
+    // senza passare dalla coda (come gli eventi programmati).
+    Timer CallAfter( boost::function< void () > f, Clock::duration delay )
+    {
+        return Schedule( ScheduledPtr( new ScheduledEvent( f, Clock::now() + delay ) ) );
+    }
+
+    // numero di thread del pool (zero se gli handler vengono eseguiti da Run/Poll)
+    unsigned Threads() const
+    {
+        return threads;
+    }
+
+    // Invia la richiesta req come evento Query< Req, Rep >: il future viene completato
+    // dal primo Reply (o Fail) di chi risponde. Se nessuno risponde, o se la richiesta
+    // viene scartata (vedi Backpressure), il future riceve boost::broken_promise.
+    // Rep non puo' essere void.
+    template < typename Rep, typename Req >
+    boost::shared_future< Rep > Request( const Req& req )
+    {
+        const boost::shared_ptr< QueryState< Rep > > state( new QueryState< Rep >() );
+        const boost::shared_future< Rep > result = state -> Future();
+        Post( Query< Req, Rep >( req, state ) );
+        return result;
+    }
+
+    // Come sopra, ma se entro timeout nessuno risponde il future riceve
+    // l'eccezione RequestTimeout (anche se la richiesta e' gia' stata consegnata
+    // o scartata: la risposta puo' arrivare piu' tardi, da un altro thread).
+    // Il timeout scatta nel thread che esegue Run/Poll: chi aspetta le risposte
+    // di piu' richieste in parallelo non blocca il bus.
+    template < typename Rep, typename Req >
+    boost::shared_future< Rep > Request( const Req& req, Clock::duration timeout )
+    {
+        const boost::shared_ptr< QueryState< Rep > > state( new QueryState< Rep >() );
+        const boost::shared_future< Rep > result = state -> Future();
+        const Timer timer = CallAfter( boost::bind( &QueryState< Rep >::Expire, state ), timeout );
+        // quando arriva la risposta il timeout viene annullato
+        state -> OnResult( timer.Canceller() );
+        Post( Query< Req, Rep >( req, state ) );
+        return result;
+    }
+
+    // Risponde alle richieste Query< Req, Rep > con il valore ritornato da f
+    // (se f lancia un'eccezione la riceve il richiedente).
+    template < typename Req, typename Rep >
+    Subscription Serve( boost::function< Rep ( const Req& ) > f )
+    {
+        return Subscribe< Query< Req, Rep > >( boost::bind( &EventBus::Answer< Req, Rep >, f, _1 ) );
+    }
+
+    // Accoda tutti gli eventi di [first, last) con una sola operazione
+    // sulla coda e al piu' un risveglio del consumatore.
+    // Se c'e' un limite (del bus o di un tipo) o la conflation, gli eventi
+    // vengono accodati uno alla volta.
+    template < typename It >
+    void PostMany( It first, It last )
+    {
+        typedef typename std::iterator_traits< It >::value_type E;
+        PostMany( first, last, EventPriority< E >::value );
+    }
+
+    template < typename It >
+    void PostMany( It first, It last, Priority::Level level )
+    {
+        if ( first == last )
+            return;
+        if ( bounded || configured.load( boost::memory_order_acquire ) )
+        {
+            bool queued = false;
+            for ( ; first != last; ++first )
+                queued = Enqueue( *first, level ) || queued;
+            if ( queued )
+                Wake();
+            return;
+        }
+        lanes[ level ] -> PushMany( first, last );
+        Wake();
+    }
+
+    template < typename Range >
+    void PostBatch( const Range& events )
+    {
+        PostMany( events.begin(), events.end() );
+    }
+
+    template < typename Range >
+    void PostBatch( const Range& events, Priority::Level level )
+    {
+        PostMany( events.begin(), events.end(), level );
+    }
+
+    // Gestisce un evento in coda oppure, se ce ne sono, gli eventi programmati scaduti;
+    // se non c'e' nessuno dei due, i file descriptor pronti.
+    bool PollOne()
+    {
+        if ( FireTimers() > 0 )
+            return true;
+        const bool done = PollLanes( 1 ) > 0;
+        NotifySpace();
+        return done || PollDescriptors() > 0;
+    }
+
+    // Gestisce tutti gli eventi in coda, prelevandoli a blocchi
+    // a partire dalla corsia piu' alta, gli eventi programmati scaduti
+    // e i file descriptor pronti (vedi Watch).
+    void Poll()
+    {
+        PollDescriptors();
+        for ( ;; )
+        {
+            const std::size_t fired = FireTimers();
+            if ( PollLanes( BatchSize ) > 0 )
+                NotifySpace();
+            else if ( fired == 0 )
+                return;
+        }
+    }
+
+    void RunOne()
+    {
+        if ( !Wait() ) return;
+
+        PollOne();
+    }
+
+    void Run()
+    {
+        if ( !Wait() ) return;
+
+        // preleva tutto quello che c'e' (anche quello accodato nel frattempo):
+        Poll();
+    }
+
+    // Interrompe Run e RunOne: finche' non si invoca Reset() ritornano subito.
+    void Stop()
+    {
+        {
+            boost::lock_guard< boost::mutex > lock( mtx );
+            running = false;
+        }
+        cond.notify_one();
+#ifdef ECHIDNA_HAS_POLLER
+        if ( Poller* p = poller.load() )
+            p -> Wake();
+#endif
+    }
+
+    void Reset()
+    {
+        boost::lock_guard< boost::mutex > lock( mtx );
+        running = true;
+    }
+
+    // Aspetta che i worker abbiano eseguito gli handler gia' accodati e li termina.
+    // Non va invocato da un handler.
+    void Join()
+    {
+        work.reset();
+        workers.join_all();
+        WorkerGroups joined;
+        {
+            boost::lock_guard< boost::mutex > lock( groupsMtx );
+            joined = groups;
+        }
+        for ( WorkerGroups::const_iterator g = joined.begin(); g != joined.end(); ++g )
+        {
+            g -> second -> work.reset();
+            g -> second -> workers.join_all();
         }
-        cond.notify_one();
     }
 };
 
@@ -24,24 +24,85 @@
 #ifndef ECHIDNA_EVENTMIRROR_H_
 #define ECHIDNA_EVENTMIRROR_H_
 
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include "codec.h"
 #include "eventbus.h"
 
 namespace echidna
 {
 
+// Canale verso un altro processo su cui EventMirror invia e riceve
+// gli eventi serializzati (es. SocketLink), distinti per tag (vedi EventTag).
+class MirrorLink
+{
+public:
+    // verso degli eventi di un tipo: dal bus al canale o dal canale al bus
+    enum Direction { Outgoing, Incoming };
+    typedef boost::function< void ( const char* data, std::size_t size ) > Receiver;
+
+    virtual ~MirrorLink() {}
+    // accoda i byte di un evento; false se il canale e' chiuso o pieno
+    virtual bool Send( boost::uint32_t tag, const char* data, std::size_t size ) = 0;
+    // i byte degli eventi ricevuti con tag vengono passati a r
+    virtual void SetReceiver( boost::uint32_t tag, Receiver r ) = 0;
+    virtual void ClearReceiver( boost::uint32_t tag ) = 0;
+};
+
+// Rispecchia gli eventi di tipo E in un altro processo. S e' un serializzatore
+// a stringhe:
+//   static std::string ToStream( const E& e );
+//   static E FromStream( const std::string& s );
+// oppure un codec (vedi codec.h), che codifica l'evento in un buffer riusato
+// e lo decodifica direttamente dai byte ricevuti, senza allocare stringhe.
 template < typename E, typename S >
 class EventMirror
 {
 public:
     EventMirror( boost::shared_ptr< EventBus > mb ) :
-        msgBroker( mb )
+        msgBroker( mb ),
+        tag( 0 ),
+        incoming( false ),
+        strand( mb -> NewStrand() ),
+        discarded( 0 )
     {
-        subscription = mb -> Subscribe< E >( boost::bind( &EventMirror< E, S >::Send, this, _1 ) );
+        subscription = mb -> Subscribe< E >( boost::bind( &EventMirror< E, S >::Send, this, _1 ), strand );
+    }
+    // Rispecchia attraverso link gli eventi E con il nome type: con Outgoing quelli
+    // consegnati dal bus vengono inviati, con Incoming quelli ricevuti vengono postati
+    // sul bus. Per uno stesso tipo ogni processo usa un solo verso (altrimenti
+    // gli eventi ricevuti verrebbero rimandati indietro).
+    // Con il pool di thread gli eventi inviati vengono codificati in uno strand,
+    // cosi' arrivano al link nell'ordine in cui il bus li consegna: per default
+    // ogni EventMirror ha il suo, e i mirror che ricevono lo stesso strand
+    // mantengono l'ordine anche tra eventi di tipi diversi.
+    EventMirror( boost::shared_ptr< EventBus > mb, boost::shared_ptr< MirrorLink > l, const std::string& type, MirrorLink::Direction d,
+                 EventBus::StrandPtr sharedStrand = EventBus::StrandPtr() ) :
+        msgBroker( mb ),
+        link( l ),
+        tag( EventTag( type ) ),
+        incoming( d == MirrorLink::Incoming ),
+        strand( !incoming && !sharedStrand ? mb -> NewStrand() : sharedStrand ),
+        discarded( 0 )
+    {
+        if ( !incoming )
+            subscription = mb -> Subscribe< E >( boost::bind( &EventMirror< E, S >::Send, this, _1 ), strand );
+        else
+            link -> SetReceiver( tag, boost::bind( &EventMirror< E, S >::Received, this, _1, _2 ) );
     }
     ~EventMirror()
     {
         subscription.Disconnect();
+        // gli eventi gia' accodati nello strand usano ancora il mirror
+        msgBroker -> Drain( strand );
+        if ( incoming )
+            link -> ClearReceiver( tag );
     }
     void StreamReceived( const std::string& s )
     {
@@ -50,16 +111,84 @@ public:
     }
     void SendStream( const std::string& toSend )
     {
-        std::cout << "--> " << toSend << std::endl;
+        if ( link )
+            link -> Send( tag, toSend.data(), toSend.size() );
+        else
+            std::cout << "--> " << toSend << std::endl;
+    }
+    // eventi ricevuti che il codec non ha saputo decodificare
+    unsigned long Discarded() const
+    {
+        return discarded.load( boost::memory_order_relaxed );
     }
 private:
+    typedef boost::integral_constant< bool, IsCodec< S, E >::value > Binary;
+    // gli eventi che ci stanno vengono codificati sullo stack
+    enum { StackBuffer = 256 };
+
     void Send( const E& event )
+    {
+        Encode( event, Binary() );
+    }
+    void Received( const char* data, std::size_t size )
+    {
+        Decode( data, size, Binary() );
+    }
+    void Encode( const E& event, boost::false_type )
     {
         std::string s = S::ToStream( event );
         SendStream( s );
     }
+    void Encode( const E& event, boost::true_type )
+    {
+        const std::size_t size = S::Size( event );
+        if ( size <= StackBuffer )
+        {
+            char local[ StackBuffer ];
+            S::Encode( event, local );
+            Forward( local, size );
+            return;
+        }
+        // Send viene eseguita nello strand del mirror, un evento alla volta
+        if ( buffer.size() < size )
+            buffer.resize( size );
+        S::Encode( event, &buffer[ 0 ] );
+        Forward( &buffer[ 0 ], size );
+    }
+    void Forward( const char* data, std::size_t size )
+    {
+        if ( link )
+            link -> Send( tag, data, size );
+        else
+            std::cout << "--> " << size << " bytes" << std::endl;
+    }
+    void Decode( const char* data, std::size_t size, boost::false_type )
+    {
+        // il link invoca il receiver da un thread alla volta: la stringa
+        // riusa la sua memoria e non alloca a ogni evento
+        received.assign( data, size );
+        StreamReceived( received );
+    }
+    void Decode( const char* data, std::size_t size, boost::true_type )
+    {
+        try
+        {
+            msgBroker -> Post( S::Decode( data, size ) );
+        }
+        catch ( const CodecError& )
+        {
+            discarded.fetch_add( 1, boost::memory_order_relaxed );
+        }
+    }
     boost::shared_ptr< EventBus > msgBroker;
+    boost::shared_ptr< MirrorLink > link;
+    const boost::uint32_t tag;
+    const bool incoming;
+    const EventBus::StrandPtr strand;
     EventBus::Subscription subscription;
+    std::string received;
+    std::vector< char > buffer;
+    boost::atomic< unsigned long > discarded;
 };
 
 } // namespace echidna
@@ -0,0 +1,409 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_EVENTQUEUE_H_
+#define ECHIDNA_EVENTQUEUE_H_
+
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <new>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <boost/utility.hpp>
+
+namespace echidna
+{
+
+// Coda lock-free con piu' produttori e un consumatore.
+// Gli elementi vengono scritti in un buffer circolare (algoritmo di D. Vyukov):
+// produttori e consumatore si contendono solo gli indici con una CAS.
+// Se il buffer circolare e' pieno gli elementi vanno in una coda di overflow
+// protetta da mutex: in questo modo Push non fallisce mai e l'ordine
+// degli elementi di ogni produttore viene mantenuto.
+// Una coda limitata (bounded) invece non usa mai l'overflow: quando il buffer
+// circolare e' pieno Push fallisce.
+template < typename T >
+class EventQueue : private boost::noncopyable
+{
+public:
+
+    // la capacita' del buffer circolare viene arrotondata alla potenza di 2 successiva
+    explicit EventQueue( std::size_t capacity = 1024, bool bounded = false );
+    ~EventQueue();
+
+    // accoda un T costruito direttamente nel buffer a partire da v
+    // (si puo' invocare da qualunque thread).
+    // Ritorna false solo se la coda e' limitata e piena.
+    template < typename V >
+    bool Push( const V& v );
+
+    // accoda tutti gli elementi di [first, last), riservando i posti
+    // nel buffer circolare con una sola CAS.
+    // Ritorna false (senza accodare niente) solo se la coda e' limitata e piena.
+    template < typename It >
+    bool PushMany( It first, It last );
+
+    // Se la coda non e' vuota, passa a f l'elemento in testa e poi lo rimuove.
+    // L'elemento non viene copiato (salvo che si trovi nella coda di overflow).
+    template < typename F >
+    bool Consume( F f );
+
+    // Estrae fino a max elementi con una sola CAS (o con un solo lock se si trovano
+    // nella coda di overflow) e li passa a f uno alla volta. Ritorna quanti sono.
+    // Se f tira un'eccezione, gli elementi rimanenti del blocco vengono scartati.
+    template < typename F >
+    std::size_t ConsumeMany( F f, std::size_t max );
+
+    bool Empty() const;
+
+private:
+
+    enum { CacheLine = 64 };
+
+    struct Slot
+    {
+        boost::atomic< std::size_t > seq;
+        typename boost::aligned_storage< sizeof( T ), boost::alignment_of< T >::value >::type data;
+    };
+
+    template < typename V >
+    bool TryPush( const V& v );
+    template < typename It >
+    bool TryPushMany( It first, std::size_t n );
+    template < typename F >
+    bool TryConsume( F& f );
+    static std::size_t RoundUp( std::size_t n );
+    // true se tutti i posti riservati nel buffer circolare sono stati consumati
+    bool RingDrained() const;
+
+    // distrugge l'elemento di uno slot e lo restituisce ai produttori
+    class Release : private boost::noncopyable
+    {
+    public:
+        Release( Slot& _s, std::size_t _seq ) : s( _s ), seq( _seq ) {}
+        ~Release()
+        {
+            reinterpret_cast< T* >( &s.data ) -> ~T();
+            s.seq.store( seq, boost::memory_order_release );
+        }
+    private:
+        Slot& s;
+        const std::size_t seq;
+    };
+
+    const std::size_t mask;
+    Slot* const ring;
+    const bool bounded;
+
+    // gli indici stanno su linee di cache diverse per non farle rimbalzare
+    // tra i core dei produttori e quello del consumatore
+    char pad0[ CacheLine ];
+    boost::atomic< std::size_t > enqueuePos;
+    char pad1[ CacheLine ];
+    boost::atomic< std::size_t > dequeuePos;
+    char pad2[ CacheLine ];
+
+    boost::atomic< bool > overflowing;
+    boost::mutex overflowMtx;
+    std::deque< T > overflow;
+};
+
+
+// ########## implementation ###########
+
+template < typename T >
+inline EventQueue< T >::EventQueue( std::size_t capacity, bool _bounded ) :
+    mask( RoundUp( capacity ) - 1 ),
+    ring( new Slot[ mask + 1 ] ),
+    bounded( _bounded ),
+    enqueuePos( 0 ),
+    dequeuePos( 0 ),
+    overflowing( false )
+{
+    for ( std::size_t i = 0; i <= mask; ++i )
+        ring[ i ].seq.store( i, boost::memory_order_relaxed );
+}
+
+template < typename T >
+inline EventQueue< T >::~EventQueue()
+{
+    // distrugge gli elementi rimasti nel buffer circolare
+    for ( std::size_t pos = dequeuePos.load(); pos != enqueuePos.load(); ++pos )
+    {
+        Slot& s = ring[ pos & mask ];
+        if ( s.seq.load() == pos + 1 )
+            reinterpret_cast< T* >( &s.data ) -> ~T();
+    }
+    delete [] ring;
+}
+
+template < typename T >
+template < typename V >
+inline bool EventQueue< T >::Push( const V& v )
+{
+    if ( bounded )
+        return TryPush( v );
+
+    // finche' c'e' qualcosa in overflow non si puo' usare il buffer circolare,
+    // altrimenti gli elementi successivi potrebbero superare quelli in overflow
+    if ( !overflowing.load( boost::memory_order_acquire ) && TryPush( v ) )
+        return true;
+
+    boost::lock_guard< boost::mutex > lock( overflowMtx );
+    overflowing.store( true, boost::memory_order_release );
+    overflow.push_back( T( v ) );
+    return true;
+}
+
+template < typename T >
+template < typename It >
+inline bool EventQueue< T >::PushMany( It first, It last )
+{
+    const std::size_t n = std::distance( first, last );
+    if ( bounded )
+        return TryPushMany( first, n );
+
+    if ( !overflowing.load( boost::memory_order_acquire ) && TryPushMany( first, n ) )
+        return true;
+
+    boost::lock_guard< boost::mutex > lock( overflowMtx );
+    overflowing.store( true, boost::memory_order_release );
+    for ( ; first != last; ++first )
+        overflow.push_back( T( *first ) );
+    return true;
+}
+
+template < typename T >
+template < typename F >
+inline bool EventQueue< T >::Consume( F f )
+{
+    for ( ;; )
+    {
+        if ( TryConsume( f ) )
+            return true;
+        if ( !overflowing.load( boost::memory_order_acquire ) )
+            return false;
+        if ( RingDrained() )
+            break;
+        // un produttore ha riservato la testa ma non l'ha ancora scritta:
+        // i suoi elementi in overflow vengono dopo
+        boost::this_thread::yield();
+    }
+
+    // il buffer circolare e' vuoto: si passa alla coda di overflow.
+    // f viene invocato dopo aver rilasciato il mutex, perche' potrebbe accodare altri elementi.
+    boost::unique_lock< boost::mutex > lock( overflowMtx );
+    if ( overflow.empty() )
+        return false;
+    const T v( overflow.front() );
+    overflow.pop_front();
+    if ( overflow.empty() )
+        overflowing.store( false, boost::memory_order_release );
+    lock.unlock();
+
+    f( v );
+    return true;
+}
+
+template < typename T >
+template < typename F >
+inline std::size_t EventQueue< T >::ConsumeMany( F f, std::size_t max )
+{
+    // si cerca il blocco di elementi gia' pubblicati a partire dalla testa
+    std::size_t pos = dequeuePos.load( boost::memory_order_relaxed );
+    std::size_t n;
+    for ( ;; )
+    {
+        n = 0;
+        while ( n < max && ring[ ( pos + n ) & mask ].seq.load( boost::memory_order_acquire ) == pos + n + 1 )
+            ++n;
+        if ( n > 0 )
+        {
+            if ( dequeuePos.compare_exchange_weak( pos, pos + n, boost::memory_order_relaxed ) )
+                break;
+            continue;
+        }
+        // come in Consume: l'overflow solo quando il buffer circolare e' davvero vuoto
+        if ( !overflowing.load( boost::memory_order_acquire ) || RingDrained() )
+            break;
+        boost::this_thread::yield();
+        pos = dequeuePos.load( boost::memory_order_relaxed );
+    }
+
+    if ( n > 0 )
+    {
+        std::size_t i = 0;
+        try
+        {
+            for ( ; i < n; ++i )
+            {
+                Slot& s = ring[ ( pos + i ) & mask ];
+                Release release( s, pos + i + mask + 1 );
+                f( *reinterpret_cast< const T* >( &s.data ) );
+            }
+        }
+        catch ( ... )
+        {
+            // gli slot rimanenti vanno comunque restituiti ai produttori
+            for ( ++i; i < n; ++i )
+                Release release( ring[ ( pos + i ) & mask ], pos + i + mask + 1 );
+            throw;
+        }
+        return n;
+    }
+
+    if ( !overflowing.load( boost::memory_order_acquire ) )
+        return 0;
+
+    // il buffer circolare e' vuoto: si prende tutta la coda di overflow
+    std::deque< T > batch;
+    {
+        boost::lock_guard< boost::mutex > lock( overflowMtx );
+        batch.swap( overflow );
+        overflowing.store( false, boost::memory_order_release );
+    }
+    for ( typename std::deque< T >::const_iterator i = batch.begin(); i != batch.end(); ++i )
+        f( *i );
+    return batch.size();
+}
+
+template < typename T >
+inline bool EventQueue< T >::Empty() const
+{
+    const std::size_t pos = dequeuePos.load( boost::memory_order_relaxed );
+    return ring[ pos & mask ].seq.load( boost::memory_order_acquire ) != pos + 1 &&
+           !overflowing.load( boost::memory_order_acquire );
+}
+
+template < typename T >
+template < typename V >
+inline bool EventQueue< T >::TryPush( const V& v )
+{
+    Slot* s;
+    std::size_t pos = enqueuePos.load( boost::memory_order_relaxed );
+    for ( ;; )
+    {
+        s = &ring[ pos & mask ];
+        const std::size_t seq = s -> seq.load( boost::memory_order_acquire );
+        const boost::intptr_t dif = static_cast< boost::intptr_t >( seq ) - static_cast< boost::intptr_t >( pos );
+        if ( dif == 0 )
+        {
+            if ( enqueuePos.compare_exchange_weak( pos, pos + 1, boost::memory_order_relaxed ) )
+                break;
+        }
+        else if ( dif < 0 )
+            return false; // pieno
+        else
+            pos = enqueuePos.load( boost::memory_order_relaxed );
+    }
+
+    new ( &s -> data ) T( v );
+    s -> seq.store( pos + 1, boost::memory_order_release );
+    return true;
+}
+
+template < typename T >
+template < typename It >
+inline bool EventQueue< T >::TryPushMany( It first, std::size_t n )
+{
+    if ( n > mask + 1 )
+        return false;
+
+    std::size_t pos = enqueuePos.load( boost::memory_order_relaxed );
+    for ( ;; )
+    {
+        // tutti gli n slot a partire da pos devono essere liberi
+        bool stale = false;
+        for ( std::size_t i = 0; i < n && !stale; ++i )
+        {
+            const std::size_t seq = ring[ ( pos + i ) & mask ].seq.load( boost::memory_order_acquire );
+            const boost::intptr_t dif = static_cast< boost::intptr_t >( seq ) - static_cast< boost::intptr_t >( pos + i );
+            if ( dif < 0 )
+                return false; // non c'e' abbastanza spazio
+            stale = ( dif > 0 );
+        }
+        if ( stale )
+            pos = enqueuePos.load( boost::memory_order_relaxed );
+        else if ( enqueuePos.compare_exchange_weak( pos, pos + n, boost::memory_order_relaxed ) )
+            break;
+    }
+
+    for ( std::size_t i = 0; i < n; ++i, ++first )
+    {
+        Slot& s = ring[ ( pos + i ) & mask ];
+        new ( &s.data ) T( *first );
+        s.seq.store( pos + i + 1, boost::memory_order_release );
+    }
+    return true;
+}
+
+template < typename T >
+template < typename F >
+inline bool EventQueue< T >::TryConsume( F& f )
+{
+    Slot* s;
+    std::size_t pos = dequeuePos.load( boost::memory_order_relaxed );
+    for ( ;; )
+    {
+        s = &ring[ pos & mask ];
+        const std::size_t seq = s -> seq.load( boost::memory_order_acquire );
+        const boost::intptr_t dif = static_cast< boost::intptr_t >( seq ) - static_cast< boost::intptr_t >( pos + 1 );
+        if ( dif == 0 )
+        {
+            if ( dequeuePos.compare_exchange_weak( pos, pos + 1, boost::memory_order_relaxed ) )
+                break;
+        }
+        else if ( dif < 0 )
+            return false; // vuoto (o un produttore non ha ancora finito di scrivere)
+        else
+            pos = dequeuePos.load( boost::memory_order_relaxed );
+    }
+
+    // lo slot viene liberato anche se f tira un'eccezione
+    Release release( *s, pos + mask + 1 );
+    f( *reinterpret_cast< const T* >( &s -> data ) );
+    return true;
+}
+
+template < typename T >
+inline bool EventQueue< T >::RingDrained() const
+{
+    return dequeuePos.load( boost::memory_order_acquire ) == enqueuePos.load( boost::memory_order_acquire );
+}
+
+template < typename T >
+inline std::size_t EventQueue< T >::RoundUp( std::size_t n )
+{
+    std::size_t result = 2;
+    while ( result < n )
+        result <<= 1;
+    return result;
+}
+
+} // namespace echidna
+
+#endif // ECHIDNA_EVENTQUEUE_H_
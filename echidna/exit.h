@@ -24,6 +24,8 @@
 #ifndef ECHIDNA_EVENT_EXIT_H_
 #define ECHIDNA_EVENT_EXIT_H_
 
+#include "priority.h"
+
 namespace echidna
 {
 namespace event
@@ -37,6 +39,14 @@ struct Exit
 };
 
 } // namespace event
+
+// la terminazione non deve aspettare che si svuoti la coda
+template <>
+struct EventPriority< event::Exit >
+{
+    static const Priority::Level value = Priority::High;
+};
+
 } // namespace echidna
 
 #endif // ECHIDNA_EVENT_EXIT_H_
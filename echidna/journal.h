@@ -0,0 +1,446 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_JOURNAL_H_
+#define ECHIDNA_JOURNAL_H_
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/version.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "codec.h"
+#include "eventbus.h"
+
+#if BOOST_VERSION >= 107300
+#include <boost/atomic/atomic_ref.hpp>
+#endif
+
+namespace echidna
+{
+
+// Formato dei segmenti del journal: un'intestazione di 16 byte (JournalSegment::Magic)
+// seguita dai record, allineati a 8 byte. Ogni record e' JournalEntry seguito dai byte
+// dell'evento codificati dal suo codec; un record con tag zero (o la fine del file)
+// chiude il segmento. I segmenti si chiamano path.000001, path.000002, ...
+struct JournalEntry
+{
+    boost::uint32_t size;  // byte dell'evento
+    boost::uint32_t tag;   // EventTag del nome del tipo
+    boost::int64_t time;   // nanosecondi dall'epoch (system_clock)
+};
+
+// Il tag di un record viene scritto per ultimo con una store release e letto
+// con una load acquire: chi legge un segmento ancora in scrittura (anche da un
+// altro processo) vede il tag zero oppure il record completo.
+inline void PublishTag( JournalEntry& entry, boost::uint32_t tag )
+{
+#if BOOST_VERSION >= 107300
+    boost::atomic_ref< boost::uint32_t >( entry.tag ).store( tag, boost::memory_order_release );
+#else
+    boost::atomic_thread_fence( boost::memory_order_release );
+    *static_cast< volatile boost::uint32_t* >( &entry.tag ) = tag;
+#endif
+}
+
+inline boost::uint32_t LoadTag( const JournalEntry& entry )
+{
+#if BOOST_VERSION >= 107300
+    return boost::atomic_ref< boost::uint32_t >( const_cast< boost::uint32_t& >( entry.tag ) ).load( boost::memory_order_acquire );
+#else
+    const boost::uint32_t tag = *static_cast< const volatile boost::uint32_t* >( &entry.tag );
+    boost::atomic_thread_fence( boost::memory_order_acquire );
+    return tag;
+#endif
+}
+
+class JournalSegment : private boost::noncopyable
+{
+public:
+    static const char* Magic() { return "echidna journal1"; }
+    enum { HeaderSize = 16 };
+
+    // crea il file del segmento di size byte e lo mappa in memoria
+    JournalSegment( const std::string& f, std::size_t size ) :
+        file( CreateFile( f, size ) ),
+        mapping( file.c_str(), boost::interprocess::read_write ),
+        region( mapping, boost::interprocess::read_write )
+    {
+        std::memcpy( Base(), Magic(), HeaderSize );
+    }
+
+    // mappa in sola lettura un segmento esistente
+    explicit JournalSegment( const std::string& f ) :
+        file( f ),
+        mapping( file.c_str(), boost::interprocess::read_only ),
+        region( mapping, boost::interprocess::read_only )
+    {
+        if ( region.get_size() < HeaderSize || std::memcmp( Base(), Magic(), HeaderSize ) != 0 )
+            throw std::runtime_error( "Journal: " + file + " is not a journal segment" );
+    }
+
+    char* Base() const { return static_cast< char* >( region.get_address() ); }
+    std::size_t Size() const { return region.get_size(); }
+    const std::string& File() const { return file; }
+
+    // scrive su disco i byte [from, to)
+    void Flush( std::size_t from, std::size_t to )
+    {
+        if ( to > from )
+            region.flush( from, to - from );
+    }
+
+    // Tocca una pagina ogni 4 KB, perche' il sistema le allochi subito
+    // e non durante le scritture dei record.
+    void Prefault()
+    {
+        volatile char* p = Base();
+        for ( std::size_t i = HeaderSize; i < Size(); i += 4096 )
+            p[ i ] = 0;
+    }
+
+    static std::string Name( const std::string& path, unsigned number )
+    {
+        char suffix[ 16 ];
+        std::sprintf( suffix, ".%06u", number );
+        return path + suffix;
+    }
+
+    static bool Exists( const std::string& file )
+    {
+        return std::ifstream( file.c_str() ).good();
+    }
+
+private:
+    static const std::string& CreateFile( const std::string& file, std::size_t size )
+    {
+        std::filebuf fb;
+        if ( !fb.open( file.c_str(), std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary ) ||
+             fb.pubseekoff( size - 1, std::ios::beg ) != std::streampos( size - 1 ) ||
+             fb.sputc( 0 ) != 0 )
+            throw std::runtime_error( "Journal: cannot create " + file );
+        return file;
+    }
+
+    std::string file;
+    boost::interprocess::file_mapping mapping;
+    boost::interprocess::mapped_region region;
+};
+
+// Registra su file gli eventi dei tipi indicati, nell'ordine in cui vengono
+// consegnati dal bus, per l'analisi a posteriori (vedi JournalReader).
+// Gli eventi vengono codificati direttamente nel segmento mappato in memoria
+// (vedi codec.h): sul thread del bus restano il codec e una memcpy sotto un lock breve.
+// Con il pool di thread gli eventi vengono registrati in uno strand del journal,
+// quindi anche in questo caso nell'ordine di consegna.
+// Un thread in background prepara il segmento successivo, scrive su disco
+// le pagine modificate ogni flushPeriod e chiude i segmenti pieni.
+// I nuovi segmenti seguono quelli gia' presenti con lo stesso path.
+class Journal : private boost::noncopyable
+{
+public:
+    typedef boost::chrono::steady_clock Clock;
+
+    Journal( boost::shared_ptr< EventBus > mb, const std::string& p,
+             std::size_t segmentSize = 64 * 1024 * 1024,
+             Clock::duration flushPeriod = boost::chrono::milliseconds( 100 ) ) :
+        msgBroker( mb ),
+        strand( mb -> NewStrand() ),
+        path( p ),
+        size( segmentSize ),
+        period( flushPeriod ),
+        number( 1 ),
+        used( 0 ),
+        flushed( 0 ),
+        preparing( false ),
+        running( true ),
+        dropped( 0 )
+    {
+        if ( size <= JournalSegment::HeaderSize + sizeof( JournalEntry ) )
+            throw std::invalid_argument( "Journal: segment size too small" );
+        while ( JournalSegment::Exists( JournalSegment::Name( path, number ) ) )
+            ++number;
+        current = Create();
+        current -> Prefault();
+        used = JournalSegment::HeaderSize;
+        flushed = used;
+        writer = boost::thread( boost::bind( &Journal::Write, this ) );
+    }
+
+    ~Journal()
+    {
+        for ( std::vector< EventBus::Subscription >::iterator i = subscriptions.begin(); i != subscriptions.end(); ++i )
+            i -> Disconnect();
+        // i record gia' accodati nello strand scrivono ancora nel segmento
+        msgBroker -> Drain( strand );
+        {
+            boost::lock_guard< boost::mutex > lock( mtx );
+            running = false;
+        }
+        cond.notify_one();
+        writer.join();
+        for ( std::vector< Retired >::iterator r = retired.begin(); r != retired.end(); ++r )
+            r -> segment -> Flush( r -> from, r -> to );
+        current -> Flush( flushed, used );
+        if ( next )
+        {
+            const std::string unused = next -> File();
+            next.reset();
+            std::remove( unused.c_str() );
+        }
+    }
+
+    // registra gli eventi di tipo E (o derivati) con il nome type, codificati da C
+    template < typename E, typename C >
+    void Record( const std::string& type )
+    {
+        const boost::uint32_t tag = EventTag( type );
+        if ( tag == 0 )
+            throw std::invalid_argument( "Journal: reserved tag for event type " + type );
+        subscriptions.push_back( msgBroker -> Subscribe< E >(
+            boost::bind( &Journal::Append< E, C >, this, tag, _1 ), strand ) );
+    }
+
+    template < typename E >
+    void Record( const std::string& type )
+    {
+        Record< E, PodCodec< E > >( type );
+    }
+
+    // eventi non registrati: piu' grandi di un segmento o segmento non creato
+    unsigned long Dropped() const
+    {
+        return dropped.load( boost::memory_order_relaxed );
+    }
+
+private:
+    typedef boost::shared_ptr< JournalSegment > SegmentPtr;
+
+    static std::size_t Align( std::size_t n )
+    {
+        return ( n + 7 ) & ~std::size_t( 7 );
+    }
+
+    template < typename E, typename C >
+    void Append( boost::uint32_t tag, const E& event )
+    {
+        const std::size_t bytes = C::Size( event );
+        const std::size_t total = Align( sizeof( JournalEntry ) + bytes );
+        const boost::int64_t time = boost::chrono::duration_cast< boost::chrono::nanoseconds >(
+            boost::chrono::system_clock::now().time_since_epoch() ).count();
+
+        boost::unique_lock< boost::mutex > lock( mtx );
+        if ( used + total > size && !Roll( lock, total ) )
+        {
+            dropped.fetch_add( 1, boost::memory_order_relaxed );
+            return;
+        }
+        // i record sono allineati a 8 byte (vedi Align)
+        JournalEntry& entry = *reinterpret_cast< JournalEntry* >( current -> Base() + used );
+        C::Encode( event, reinterpret_cast< char* >( &entry + 1 ) );
+        entry.size = static_cast< boost::uint32_t >( bytes );
+        entry.time = time;
+        // il tag per ultimo: un record a meta' ha ancora il tag zero
+        PublishTag( entry, tag );
+        used += total;
+    }
+
+    // passa al segmento successivo (lock e' mtx)
+    bool Roll( boost::unique_lock< boost::mutex >& lock, std::size_t total )
+    {
+        if ( JournalSegment::HeaderSize + total > size )
+            return false;
+        // Il segmento in preparazione ha gia' il suo numero: se se ne creasse
+        // un altro qui, i file non seguirebbero piu' l'ordine dei record.
+        while ( preparing )
+            prepared.wait( lock );
+        SegmentPtr segment = next;
+        next.reset();
+        if ( !segment )
+        {
+            // il thread in background non ha fatto in tempo
+            try
+            {
+                segment = Create();
+            }
+            catch ( const std::exception& )
+            {
+                return false;
+            }
+        }
+        retired.push_back( Retired( current, flushed, used ) );
+        current = segment;
+        used = JournalSegment::HeaderSize;
+        flushed = used;
+        cond.notify_one();
+        return true;
+    }
+
+    SegmentPtr Create()
+    {
+        return SegmentPtr( new JournalSegment( JournalSegment::Name( path, number++ ), size ) );
+    }
+
+    struct Retired
+    {
+        Retired( SegmentPtr s, std::size_t f, std::size_t t ) : segment( s ), from( f ), to( t ) {}
+        SegmentPtr segment;
+        std::size_t from;
+        std::size_t to;
+    };
+
+    // thread in background
+    void Write()
+    {
+        boost::unique_lock< boost::mutex > lock( mtx );
+        while ( running )
+        {
+            std::vector< Retired > full;
+            full.swap( retired );
+            const SegmentPtr segment = current;
+            const std::size_t from = flushed;
+            const std::size_t to = used;
+            flushed = used;
+            const bool prepare = !next;
+            const unsigned n = prepare ? number++ : 0;
+            preparing = prepare;
+
+            lock.unlock();
+            for ( std::vector< Retired >::iterator r = full.begin(); r != full.end(); ++r )
+                r -> segment -> Flush( r -> from, r -> to );
+            full.clear(); // chiude i segmenti pieni
+            segment -> Flush( from, to );
+            SegmentPtr created;
+            if ( prepare )
+            {
+                try
+                {
+                    created.reset( new JournalSegment( JournalSegment::Name( path, n ), size ) );
+                    created -> Prefault();
+                }
+                catch ( const std::exception& )
+                {
+                    // ci riprova Roll
+                }
+            }
+            lock.lock();
+
+            if ( created )
+                next = created;
+            else if ( prepare )
+                number = n; // nessun altro prende numeri mentre preparing e' true
+            preparing = false;
+            prepared.notify_all();
+            if ( running && retired.empty() )
+                cond.wait_for( lock, period );
+        }
+    }
+
+    const boost::shared_ptr< EventBus > msgBroker;
+    const EventBus::StrandPtr strand; // un record alla volta, nell'ordine di consegna
+    const std::string path;
+    const std::size_t size;
+    const Clock::duration period;
+    std::vector< EventBus::Subscription > subscriptions;
+
+    boost::mutex mtx;
+    boost::condition_variable cond;
+    boost::condition_variable prepared; // segnalata quando preparing torna false
+    unsigned number;         // numero del prossimo segmento
+    SegmentPtr current;
+    std::size_t used;        // byte scritti in current
+    std::size_t flushed;     // byte di current gia' passati a Flush
+    SegmentPtr next;         // preparato dal thread in background
+    bool preparing;          // il thread in background sta creando next
+    std::vector< Retired > retired;
+    bool running;
+
+    boost::atomic< unsigned long > dropped;
+    boost::thread writer;
+};
+
+// Un record letto dal journal: data resta valido durante la chiamata di ForEach.
+struct JournalRecord
+{
+    boost::uint32_t tag;
+    boost::chrono::system_clock::time_point time;
+    const char* data;
+    std::size_t size;
+};
+
+// Legge i segmenti scritti da Journal con lo stesso path, es.
+//   if ( r.tag == EventTag( "Quote" ) ) Quote q = PodCodec< Quote >::Decode( r.data, r.size );
+class JournalReader
+{
+public:
+    explicit JournalReader( const std::string& p ) : path( p ) {}
+
+    // Passa a f( const JournalRecord& ) i record di tutti i segmenti, in ordine,
+    // e ritorna quanti sono.
+    template < typename F >
+    std::size_t ForEach( F& f ) const
+    {
+        std::size_t count = 0;
+        for ( unsigned n = 1; JournalSegment::Exists( JournalSegment::Name( path, n ) ); ++n )
+        {
+            const JournalSegment segment( JournalSegment::Name( path, n ) );
+            const char* const base = segment.Base();
+            std::size_t pos = JournalSegment::HeaderSize;
+            while ( pos + sizeof( JournalEntry ) <= segment.Size() )
+            {
+                const JournalEntry& entry = *reinterpret_cast< const JournalEntry* >( base + pos );
+                const boost::uint32_t tag = LoadTag( entry );
+                if ( tag == 0 || pos + sizeof( JournalEntry ) + entry.size > segment.Size() )
+                    break;
+                JournalRecord r;
+                r.tag = tag;
+                r.time = boost::chrono::system_clock::time_point(
+                    boost::chrono::duration_cast< boost::chrono::system_clock::duration >( boost::chrono::nanoseconds( entry.time ) ) );
+                r.data = base + pos + sizeof( JournalEntry );
+                r.size = entry.size;
+                f( r );
+                ++count;
+                pos += ( sizeof( JournalEntry ) + entry.size + 7 ) & ~std::size_t( 7 );
+            }
+        }
+        return count;
+    }
+
+private:
+    const std::string path;
+};
+
+} // namespace echidna
+
+#endif // ECHIDNA_JOURNAL_H_
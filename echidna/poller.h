@@ -0,0 +1,214 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_POLLER_H_
+#define ECHIDNA_POLLER_H_
+
+// Su Linux l'EventBus puo' aspettare anche su file descriptor (vedi EventBus::Watch).
+// Definendo ECHIDNA_NO_EPOLL si usa solo la condition variable.
+#if defined( __linux__ ) && !defined( ECHIDNA_NO_EPOLL )
+#define ECHIDNA_HAS_POLLER
+
+#include <cerrno>
+#include <map>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <boost/chrono.hpp>
+#include <boost/chrono/ceil.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+namespace echidna
+{
+
+// Attesa su un insieme di file descriptor con epoll, piu' un eventfd
+// per svegliare da un altro thread chi sta aspettando.
+class Poller : private boost::noncopyable
+{
+public:
+    enum Events
+    {
+        Readable = EPOLLIN,
+        Writable = EPOLLOUT
+    };
+    // riceve gli eventi di epoll (anche EPOLLHUP ed EPOLLERR)
+    typedef boost::function< void ( unsigned events ) > Handler;
+    typedef boost::chrono::steady_clock Clock;
+
+    Poller() :
+        epollFd( epoll_create1( EPOLL_CLOEXEC ) ),
+        wakeFd( eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) )
+    {
+        if ( epollFd < 0 || wakeFd < 0 )
+        {
+            const int error = errno;
+            Close();
+            Fail( error, "Poller" );
+        }
+        epoll_event ev = epoll_event();
+        ev.events = EPOLLIN;
+        ev.data.fd = wakeFd;
+        if ( epoll_ctl( epollFd, EPOLL_CTL_ADD, wakeFd, &ev ) < 0 )
+        {
+            const int error = errno;
+            Close();
+            Fail( error, "Poller" );
+        }
+    }
+
+    ~Poller()
+    {
+        Close();
+    }
+
+    // Aggiunge fd (o ne cambia gli eventi e l'handler se c'e' gia').
+    // events e' una combinazione di Readable e Writable; la notifica e' a livello:
+    // l'handler viene invocato finche' fd resta pronto.
+    void Add( int fd, unsigned events, Handler handler )
+    {
+        boost::lock_guard< boost::mutex > lock( mtx );
+        epoll_event ev = epoll_event();
+        ev.events = events;
+        ev.data.fd = fd;
+        const bool known = watched.find( fd ) != watched.end();
+        if ( epoll_ctl( epollFd, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev ) < 0 )
+            Fail( errno, "Poller::Add" );
+        watched[ fd ] = HandlerPtr( new Handler( handler ) );
+    }
+
+    // Dopo Remove l'handler di fd non viene piu' invocato
+    // (fd va rimosso prima di chiuderlo).
+    void Remove( int fd )
+    {
+        boost::lock_guard< boost::mutex > lock( mtx );
+        if ( watched.erase( fd ) > 0 )
+            epoll_ctl( epollFd, EPOLL_CTL_DEL, fd, NULL );
+    }
+
+    bool Empty() const
+    {
+        boost::lock_guard< boost::mutex > lock( mtx );
+        return watched.empty();
+    }
+
+    // Sveglia Wait (se non sta aspettando, la prossima Wait ritorna subito).
+    void Wake()
+    {
+        const eventfd_t one = 1;
+        // fallisce solo se il contatore e' al massimo: Wait si sveglia comunque
+        const ssize_t written = ::write( wakeFd, &one, sizeof( one ) );
+        ( void ) written;
+    }
+
+    // Aspetta fino a deadline (con la risoluzione del millisecondo) che un fd sia
+    // pronto o che venga invocata Wake, e invoca gli handler dei file descriptor pronti
+    // dal thread corrente. Ritorna il numero di handler invocati.
+    std::size_t Wait( Clock::time_point deadline )
+    {
+        int timeout = -1;
+        if ( deadline != Clock::time_point::max() )
+        {
+            const Clock::duration left = deadline - Clock::now();
+            // arrotondato per eccesso: non ci si sveglia prima della scadenza
+            timeout = left <= Clock::duration::zero() ? 0 :
+                static_cast< int >( boost::chrono::ceil< boost::chrono::milliseconds >( left ).count() );
+        }
+        return Wait( timeout );
+    }
+
+    // come sopra, senza aspettare
+    std::size_t Poll()
+    {
+        return Wait( 0 );
+    }
+
+private:
+    typedef boost::shared_ptr< Handler > HandlerPtr;
+    enum { MaxEvents = 64 };
+
+    std::size_t Wait( int timeout )
+    {
+        epoll_event ready[ MaxEvents ];
+        const int n = epoll_wait( epollFd, ready, MaxEvents, timeout );
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+                return 0;
+            Fail( errno, "Poller::Wait" );
+        }
+        std::size_t invoked = 0;
+        for ( int i = 0; i < n; ++i )
+        {
+            if ( ready[ i ].data.fd == wakeFd )
+            {
+                eventfd_t count;
+                const ssize_t got = ::read( wakeFd, &count, sizeof( count ) );
+                ( void ) got;
+                continue;
+            }
+            // un handler precedente puo' aver rimosso fd
+            HandlerPtr handler;
+            {
+                boost::lock_guard< boost::mutex > lock( mtx );
+                const Watched::const_iterator w = watched.find( ready[ i ].data.fd );
+                if ( w == watched.end() )
+                    continue;
+                handler = w -> second;
+            }
+            ( *handler )( ready[ i ].events );
+            ++invoked;
+        }
+        return invoked;
+    }
+
+    void Close()
+    {
+        if ( wakeFd >= 0 )
+            ::close( wakeFd );
+        if ( epollFd >= 0 )
+            ::close( epollFd );
+    }
+
+    static void Fail( int error, const char* what )
+    {
+        throw boost::system::system_error( error, boost::system::system_category(), what );
+    }
+
+    typedef std::map< int, HandlerPtr > Watched;
+
+    const int epollFd;
+    const int wakeFd;
+    mutable boost::mutex mtx;
+    Watched watched;
+};
+
+} // namespace echidna
+
+#endif // defined( __linux__ ) && !defined( ECHIDNA_NO_EPOLL )
+
+#endif // ECHIDNA_POLLER_H_
@@ -21,9 +21,38 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
  ******************************************************************************/
 
-#ifndef TOKEN_H_
-#define TOKEN_H_
+#ifndef ECHIDNA_PRIORITY_H_
+#define ECHIDNA_PRIORITY_H_
 
-struct Token {};
+namespace echidna
+{
 
-#endif // TOKEN_H_
+// Corsie di priorita' dell'EventBus: gli eventi di una corsia piu' alta
+// vengono consegnati prima di quelli gia' in coda nelle corsie piu' basse.
+struct Priority
+{
+    enum Level
+    {
+        Low,
+        Normal,
+        High,
+        Levels // numero di corsie
+    };
+};
+
+// Priorita' con cui EventBus::Post accoda un evento di tipo E, se non
+// se ne indica una esplicitamente. Si cambia specializzando il template:
+//
+//     template <> struct EventPriority< MyEvent >
+//     {
+//         static const Priority::Level value = Priority::High;
+//     };
+template < typename E >
+struct EventPriority
+{
+    static const Priority::Level value = Priority::Normal;
+};
+
+} // namespace echidna
+
+#endif // ECHIDNA_PRIORITY_H_
@@ -0,0 +1,198 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_REQUEST_H_
+#define ECHIDNA_REQUEST_H_
+
+#include <stdexcept>
+#include <boost/exception_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/future.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+#include "priority.h"
+
+namespace echidna
+{
+
+// Eccezione ricevuta dal future di una richiesta scaduta (vedi EventBus::Request).
+class RequestTimeout : public std::runtime_error
+{
+public:
+    RequestTimeout() : std::runtime_error( "Request timed out" ) {}
+};
+
+// Stato condiviso tra chi fa una richiesta e chi risponde:
+// vale solo il primo risultato (risposta, errore o scadenza).
+template < typename Rep >
+class QueryState : private boost::noncopyable
+{
+public:
+    QueryState() : done( false ) {}
+
+    // Se nessuno ha risposto, il future riceve boost::broken_promise
+    // e chi aspetta con OnDone viene avvisato.
+    ~QueryState()
+    {
+        if ( done )
+            return;
+        promise.set_exception( boost::copy_exception( boost::broken_promise() ) );
+        if ( callback )
+            callback();
+    }
+
+    boost::shared_future< Rep > Future()
+    {
+        return boost::shared_future< Rep >( promise.get_future() );
+    }
+
+    bool SetValue( const Rep& rep )
+    {
+        {
+            boost::lock_guard< boost::mutex > lock( mtx );
+            if ( done )
+                return false;
+            done = true;
+            promise.set_value( rep );
+        }
+        Notify();
+        return true;
+    }
+
+    bool SetException( boost::exception_ptr e )
+    {
+        {
+            boost::lock_guard< boost::mutex > lock( mtx );
+            if ( done )
+                return false;
+            done = true;
+            promise.set_exception( e );
+        }
+        Notify();
+        return true;
+    }
+
+    // f viene invocata (una volta sola, senza lock) quando il future e' pronto:
+    // subito se lo e' gia', altrimenti dal thread che lo completa.
+    void OnDone( boost::function< void () > f )
+    {
+        {
+            boost::lock_guard< boost::mutex > lock( mtx );
+            if ( !done )
+            {
+                callback = f;
+                return;
+            }
+        }
+        f();
+    }
+
+    // Come OnDone, ma per chi invia la richiesta (es. per annullarne il timeout):
+    // non sostituisce la funzione passata a OnDone.
+    void OnResult( boost::function< void () > f )
+    {
+        {
+            boost::lock_guard< boost::mutex > lock( mtx );
+            if ( !done )
+            {
+                result = f;
+                return;
+            }
+        }
+        f();
+    }
+
+    bool Done() const
+    {
+        boost::lock_guard< boost::mutex > lock( mtx );
+        return done;
+    }
+
+    // invocata allo scadere del timeout
+    static void Expire( const boost::shared_ptr< QueryState >& state )
+    {
+        state -> SetException( boost::copy_exception( RequestTimeout() ) );
+    }
+
+private:
+    void Notify()
+    {
+        boost::function< void () > f, r;
+        {
+            boost::lock_guard< boost::mutex > lock( mtx );
+            f.swap( callback );
+            r.swap( result );
+        }
+        if ( r )
+            r();
+        if ( f )
+            f();
+    }
+
+    mutable boost::mutex mtx;
+    boost::promise< Rep > promise;
+    bool done;
+    boost::function< void () > callback;
+    boost::function< void () > result;
+};
+
+// Evento che trasporta una richiesta di tipo Req con risposta di tipo Rep.
+// Chi risponde si sottoscrive a Query< Req, Rep > (o usa EventBus::Serve)
+// e invoca Reply: il future del richiedente viene completato direttamente,
+// senza accodare un altro evento.
+template < typename Req, typename Rep >
+class Query
+{
+public:
+    Query( const Req& r, boost::shared_ptr< QueryState< Rep > > s ) : request( r ), state( s ) {}
+
+    const Req& Request() const { return request; }
+
+    // Ritorna false se la richiesta aveva gia' un risultato.
+    bool Reply( const Rep& rep ) const { return state -> SetValue( rep ); }
+
+    // Il richiedente ricevera' l'eccezione x.
+    template < typename X >
+    bool Fail( const X& x ) const { return state -> SetException( boost::copy_exception( x ) ); }
+
+    bool Fail( boost::exception_ptr e ) const { return state -> SetException( e ); }
+
+    bool Replied() const { return state -> Done(); }
+
+private:
+    Req request;
+    boost::shared_ptr< QueryState< Rep > > state;
+};
+
+// le richieste viaggiano con la priorita' del loro tipo
+template < typename Req, typename Rep >
+struct EventPriority< Query< Req, Rep > >
+{
+    static const Priority::Level value = EventPriority< Req >::value;
+};
+
+} // namespace echidna
+
+#endif // ECHIDNA_REQUEST_H_
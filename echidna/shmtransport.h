@@ -0,0 +1,375 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_SHMTRANSPORT_H_
+#define ECHIDNA_SHMTRANSPORT_H_
+
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include "codec.h"
+#include "eventbus.h"
+#include "waitstrategy.h"
+
+namespace echidna
+{
+
+// Ring di byte in un segmento di memoria condivisa (POSIX shm_open) con un solo
+// processo che scrive e un solo processo che legge. Ogni record e' un'intestazione
+// (lunghezza e tag del tipo) seguita dai byte dell'evento, allineato a 8 byte;
+// un record non viene mai spezzato a fine buffer. Scrittura e lettura non fanno
+// chiamate di sistema: i due processi si sincronizzano solo con le posizioni atomiche.
+// Il primo che apre il ring lo crea; il segmento resta finche' non si invoca Remove.
+class ShmRing : private boost::noncopyable
+{
+public:
+    ShmRing( const std::string& name, std::size_t capacity ) :
+        segment( boost::interprocess::open_or_create, name.c_str(), Align( capacity ) + Overhead ),
+        header( segment.find_or_construct< Header >( "echidna.ring" )( Align( capacity ) ) ),
+        data( segment.find_or_construct< char >( "echidna.data" )[ header -> capacity ]( 0 ) ),
+        pending( 0 )
+    {
+        // le posizioni vengono condivise tra processi: devono essere lock-free
+        if ( !header -> head.is_lock_free() )
+            throw std::runtime_error( "ShmRing: 64 bit atomics are not lock-free on this platform" );
+    }
+
+    static void Remove( const std::string& name )
+    {
+        boost::interprocess::shared_memory_object::remove( name.c_str() );
+    }
+
+    // Riserva il record con tag e size byte e ritorna dove scriverli (NULL se non c'e' spazio).
+    // Il record diventa visibile a chi legge con Commit. Solo per chi scrive.
+    char* Reserve( boost::uint32_t tag, std::size_t size )
+    {
+        const boost::uint64_t capacity = header -> capacity;
+        const boost::uint64_t total = Align( sizeof( Record ) + size );
+        const boost::uint64_t head = header -> head.load( boost::memory_order_relaxed );
+        const boost::uint64_t offset = head % capacity;
+        // se il record non ci sta prima della fine del buffer si salta all'inizio
+        const boost::uint64_t skip = offset + total > capacity ? capacity - offset : 0;
+        if ( total > capacity ||
+             head + skip + total - header -> tail.load( boost::memory_order_acquire ) > capacity )
+            return NULL;
+        if ( skip > 0 )
+            Write( data + offset, Padding, skip - sizeof( Record ) );
+        pending = head + skip + total;
+        char* record = data + ( head + skip ) % capacity;
+        Write( record, tag, size );
+        return record + sizeof( Record );
+    }
+
+    void Commit()
+    {
+        header -> head.store( pending, boost::memory_order_release );
+    }
+
+    // Passa a f( tag, bytes, size ) fino a max record e ritorna quanti sono.
+    // I byte restano validi solo durante la chiamata. Solo per chi legge.
+    template < typename F >
+    std::size_t Consume( F& f, std::size_t max )
+    {
+        const boost::uint64_t capacity = header -> capacity;
+        const boost::uint64_t head = header -> head.load( boost::memory_order_acquire );
+        boost::uint64_t tail = header -> tail.load( boost::memory_order_relaxed );
+        std::size_t n = 0;
+        while ( tail != head && n < max )
+        {
+            const boost::uint64_t offset = tail % capacity;
+            Record r;
+            std::memcpy( &r, data + offset, sizeof( Record ) );
+            if ( r.tag != Padding )
+            {
+                f( r.tag, static_cast< const char* >( data + offset + sizeof( Record ) ), static_cast< std::size_t >( r.size ) );
+                ++n;
+            }
+            tail += Align( sizeof( Record ) + r.size );
+        }
+        header -> tail.store( tail, boost::memory_order_release );
+        return n;
+    }
+
+    std::size_t Capacity() const
+    {
+        return static_cast< std::size_t >( header -> capacity );
+    }
+
+private:
+    enum { CacheLine = 64 };
+    // spazio del segmento per l'intestazione e l'indice degli oggetti con nome
+    enum { Overhead = 8192 };
+    static const boost::uint32_t Padding = 0xFFFFFFFF;
+
+    struct Record
+    {
+        boost::uint32_t size;
+        boost::uint32_t tag;
+    };
+
+    struct Header
+    {
+        explicit Header( boost::uint64_t c ) : capacity( c ), head( 0 ), tail( 0 ) {}
+        const boost::uint64_t capacity;
+        char pad0[ CacheLine ];
+        boost::atomic< boost::uint64_t > head; // byte scritti
+        char pad1[ CacheLine ];
+        boost::atomic< boost::uint64_t > tail; // byte letti
+        char pad2[ CacheLine ];
+    };
+
+    static boost::uint64_t Align( boost::uint64_t n )
+    {
+        return ( n + 7 ) & ~boost::uint64_t( 7 );
+    }
+
+    static void Write( char* where, boost::uint32_t tag, std::size_t size )
+    {
+        const Record r = { static_cast< boost::uint32_t >( size ), tag };
+        std::memcpy( where, &r, sizeof( Record ) );
+    }
+
+    boost::interprocess::managed_shared_memory segment;
+    Header* const header;
+    char* const data;
+    boost::uint64_t pending;
+};
+
+// Scrive sul ring gli eventi dei tipi esportati, quando vengono consegnati dal bus.
+// Gli eventi vengono codificati direttamente nel ring (vedi codec.h).
+// Se il ring e' pieno (l'altro processo e' lento o non c'e') l'evento viene scartato
+// e contato in Dropped: gli handler del bus non restano mai bloccati.
+// Con il pool di thread il sender ha un suo strand: gli eventi vengono scritti
+// nel ring nell'ordine in cui il bus li consegna, anche se di tipi diversi.
+class ShmSender : private boost::noncopyable
+{
+public:
+    ShmSender( boost::shared_ptr< EventBus > mb, const std::string& name, std::size_t capacity ) :
+        msgBroker( mb ),
+        strand( mb -> NewStrand() ),
+        ring( name, capacity ),
+        dropped( 0 )
+    {
+    }
+    ~ShmSender()
+    {
+        for ( std::vector< EventBus::Subscription >::iterator i = subscriptions.begin(); i != subscriptions.end(); ++i )
+            i -> Disconnect();
+        // gli eventi gia' accodati nello strand scrivono ancora nel ring
+        msgBroker -> Drain( strand );
+    }
+
+    // esporta gli eventi di tipo E (o derivati) con il nome type, codificati da C
+    template < typename E, typename C >
+    void Export( const std::string& type )
+    {
+        subscriptions.push_back( msgBroker -> Subscribe< E >(
+            boost::bind( &ShmSender::Send< E, C >, this, EventTag( type ), _1 ), strand ) );
+    }
+
+    template < typename E >
+    void Export( const std::string& type )
+    {
+        Export< E, PodCodec< E > >( type );
+    }
+
+    // eventi scartati perche' il ring era pieno
+    unsigned long Dropped() const
+    {
+        return dropped.load( boost::memory_order_relaxed );
+    }
+
+private:
+    template < typename E, typename C >
+    void Send( boost::uint32_t tag, const E& event )
+    {
+        // un solo scrittore alla volta: lo garantisce lo strand
+        char* out = ring.Reserve( tag, C::Size( event ) );
+        if ( !out )
+        {
+            dropped.fetch_add( 1, boost::memory_order_relaxed );
+            return;
+        }
+        C::Encode( event, out );
+        ring.Commit();
+    }
+
+    boost::shared_ptr< EventBus > msgBroker;
+    const EventBus::StrandPtr strand;
+    ShmRing ring;
+    std::vector< EventBus::Subscription > subscriptions;
+    boost::atomic< unsigned long > dropped;
+};
+
+// Legge il ring e fa Post sul bus degli eventi dei tipi importati: i componenti
+// si sottoscrivono come per gli eventi locali. I record di tipi non importati
+// o che il codec non riesce a decodificare vengono scartati e contati in Discarded.
+class ShmReceiver : private boost::noncopyable
+{
+public:
+    ShmReceiver( boost::shared_ptr< EventBus > mb, const std::string& name, std::size_t capacity ) :
+        msgBroker( mb ),
+        ring( name, capacity ),
+        running( false ),
+        discarded( 0 )
+    {
+    }
+    ~ShmReceiver()
+    {
+        Stop();
+    }
+
+    // importa con il nome type gli eventi di tipo E, decodificati da C (prima di Start)
+    template < typename E, typename C >
+    void Import( const std::string& type )
+    {
+        if ( !decoders.insert( std::make_pair( EventTag( type ), &Decode< E, C > ) ).second )
+            throw std::invalid_argument( "ShmReceiver: event type " + type + " imported twice (or tag collision)" );
+    }
+
+    template < typename E >
+    void Import( const std::string& type )
+    {
+        Import< E, PodCodec< E > >( type );
+    }
+
+    // Legge i record disponibili, un thread alla volta (in alternativa a Start).
+    std::size_t Poll()
+    {
+        Dispatcher d( *this );
+        std::size_t total = 0;
+        while ( std::size_t n = ring.Consume( d, Batch ) )
+            total += n;
+        return total;
+    }
+
+    // Avvia un thread che legge il ring. Senza chiamate di sistema l'altro processo
+    // non puo' svegliarlo: con Spin controlla sempre il ring, con Yield lo controlla
+    // per budget e poi cede il processore tra un controllo e l'altro, con Park
+    // lo controlla per budget e poi dorme per budget, con Block dorme subito per budget.
+    void Start( const WaitStrategy& strategy = WaitStrategy() )
+    {
+        if ( running.exchange( true ) )
+            return;
+        reader = boost::thread( boost::bind( &ShmReceiver::Read, this, strategy ) );
+    }
+
+    void Stop()
+    {
+        running = false;
+        if ( reader.joinable() )
+            reader.join();
+    }
+
+    // record scartati (tipo non importato o codifica non valida)
+    unsigned long Discarded() const
+    {
+        return discarded.load( boost::memory_order_relaxed );
+    }
+
+private:
+    typedef boost::chrono::steady_clock Clock;
+    typedef void ( *Decoder )( EventBus& bus, const char* in, std::size_t size );
+    typedef std::map< boost::uint32_t, Decoder > Decoders;
+    enum { Batch = 64 };
+
+    // invocato da ShmRing::Consume per ogni record
+    class Dispatcher
+    {
+    public:
+        explicit Dispatcher( ShmReceiver& r ) : receiver( r ) {}
+        void operator()( boost::uint32_t tag, const char* in, std::size_t size )
+        {
+            const Decoders::const_iterator i = receiver.decoders.find( tag );
+            try
+            {
+                if ( i != receiver.decoders.end() )
+                {
+                    i -> second( *receiver.msgBroker, in, size );
+                    return;
+                }
+            }
+            catch ( const CodecError& )
+            {
+            }
+            receiver.discarded.fetch_add( 1, boost::memory_order_relaxed );
+        }
+    private:
+        ShmReceiver& receiver;
+    };
+
+    template < typename E, typename C >
+    static void Decode( EventBus& bus, const char* in, std::size_t size )
+    {
+        bus.Post( C::Decode( in, size ) );
+    }
+
+    void Read( WaitStrategy strategy )
+    {
+        Clock::time_point idleSince = Clock::now();
+        bool idle = false;
+        while ( running.load( boost::memory_order_relaxed ) )
+        {
+            if ( Poll() > 0 )
+            {
+                idle = false;
+                continue;
+            }
+            if ( !idle )
+            {
+                idle = true;
+                idleSince = Clock::now();
+            }
+            const bool busy = strategy.mode == WaitStrategy::Spin ||
+                ( strategy.mode != WaitStrategy::Block && Clock::now() - idleSince < strategy.budget );
+            if ( busy )
+                CpuRelax();
+            else if ( strategy.mode == WaitStrategy::Yield )
+                boost::this_thread::yield();
+            else
+                boost::this_thread::sleep_for( strategy.budget );
+        }
+    }
+
+    boost::shared_ptr< EventBus > msgBroker;
+    ShmRing ring;
+    Decoders decoders;
+    boost::atomic< bool > running;
+    boost::atomic< unsigned long > discarded;
+    boost::thread reader;
+};
+
+} // namespace echidna
+
+#endif // ECHIDNA_SHMTRANSPORT_H_
@@ -0,0 +1,507 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_SOCKETTRANSPORT_H_
+#define ECHIDNA_SOCKETTRANSPORT_H_
+
+#include "eventmirror.h"
+
+// SocketLink aspetta il socket con EventBus::Watch: solo dove c'e' il Poller.
+#ifdef ECHIDNA_HAS_POLLER
+
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+
+namespace echidna
+{
+
+// Evento postato sul bus quando l'altro processo chiude la connessione
+// o la connessione si interrompe (error e' il codice errno, zero se chiusa).
+struct LinkClosed
+{
+    LinkClosed( const std::string& a, int e ) : address( a ), error( e ) {}
+    std::string address;
+    int error;
+};
+
+// Connessione non bloccante (TCP o socket Unix) con un altro processo,
+// su cui gli eventi viaggiano in frame con lunghezza e tag (vedi EventMirror).
+// Il socket viene gestito dal thread che esegue Run/Poll del bus (vedi EventBus::Watch).
+// I frame inviati si accumulano in un buffer, che viene scritto con una sola writev
+// dopo gli eventi gia' accodati sul bus: un blocco di Post diventa una sola chiamata
+// di sistema. I frame ricevuti vengono passati ai receiver direttamente dal buffer
+// di lettura, senza copiarli.
+// Lunghezza e tag dei frame viaggiano in network byte order; il contenuto e'
+// quello prodotto dal codec (PodCodec e FieldCodec usano la rappresentazione
+// dell'host: tra architetture diverse serve un codec portabile).
+class SocketLink : public MirrorLink, public boost::enable_shared_from_this< SocketLink >, private boost::noncopyable
+{
+public:
+    // Si connette ad address: "host:porta" per TCP, "unix:percorso" per i socket Unix.
+    static boost::shared_ptr< SocketLink > Connect( boost::shared_ptr< EventBus > bus, const std::string& address )
+    {
+        const SocketAddress a( address );
+        const int fd = ::socket( a.Family(), SOCK_STREAM | SOCK_CLOEXEC, 0 );
+        if ( fd < 0 )
+            Fail( errno, "SocketLink::Connect" );
+        if ( ::connect( fd, a.Get(), a.Length() ) < 0 )
+        {
+            const int error = errno;
+            ::close( fd );
+            Fail( error, "SocketLink::Connect" );
+        }
+        return Start( bus, fd, address );
+    }
+
+    // Aspetta su address la connessione dell'altro processo (una sola).
+    static boost::shared_ptr< SocketLink > Accept( boost::shared_ptr< EventBus > bus, const std::string& address )
+    {
+        const SocketAddress a( address );
+        const int listener = ::socket( a.Family(), SOCK_STREAM | SOCK_CLOEXEC, 0 );
+        if ( listener < 0 )
+            Fail( errno, "SocketLink::Accept" );
+        const int on = 1;
+        ::setsockopt( listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+        a.Unlink();
+        int fd = -1;
+        if ( ::bind( listener, a.Get(), a.Length() ) == 0 && ::listen( listener, 1 ) == 0 )
+        {
+            do
+                fd = ::accept( listener, NULL, NULL );
+            while ( fd < 0 && errno == EINTR );
+        }
+        const int error = errno;
+        ::close( listener );
+        a.Unlink();
+        if ( fd < 0 )
+            Fail( error, "SocketLink::Accept" );
+        return Start( bus, fd, address );
+    }
+
+    ~SocketLink()
+    {
+        Shutdown( 0, false );
+    }
+
+    // Accoda un frame (da qualsiasi thread). Se il buffer ha gia' MaxPending byte
+    // da scrivere (l'altro processo non legge) il frame viene scartato e contato in Dropped.
+    virtual bool Send( boost::uint32_t tag, const char* data, std::size_t size )
+    {
+        bool schedule = false;
+        {
+            boost::lock_guard< boost::mutex > lock( mtx );
+            if ( fd.load( boost::memory_order_relaxed ) < 0 || PendingLocked() + sizeof( Frame ) + size > MaxPending )
+            {
+                dropped.fetch_add( 1, boost::memory_order_relaxed );
+                return false;
+            }
+            const Frame f = { htonl( static_cast< boost::uint32_t >( size ) ), htonl( tag ) };
+            const char* header = reinterpret_cast< const char* >( &f );
+            pending.insert( pending.end(), header, header + sizeof( Frame ) );
+            pending.insert( pending.end(), data, data + size );
+            schedule = !flushing;
+            flushing = true;
+        }
+        // la scrittura avviene dopo gli eventi gia' accodati (e i loro Send)
+        if ( schedule && !bus -> Call( boost::bind( &SocketLink::Flush, boost::weak_ptr< SocketLink >( shared_from_this() ) ) ) )
+            Write();
+        return true;
+    }
+
+    virtual void SetReceiver( boost::uint32_t tag, Receiver r )
+    {
+        boost::lock_guard< boost::mutex > lock( receiversMtx );
+        receivers[ tag ] = r;
+    }
+
+    // Da non invocare dentro un receiver.
+    virtual void ClearReceiver( boost::uint32_t tag )
+    {
+        boost::lock_guard< boost::mutex > lock( receiversMtx );
+        receivers.erase( tag );
+    }
+
+    // Chiude la connessione: i frame non ancora scritti vengono persi.
+    void Close()
+    {
+        Shutdown( 0, false );
+    }
+
+    bool Open() const
+    {
+        return fd.load( boost::memory_order_relaxed ) >= 0;
+    }
+
+    // byte accodati e non ancora scritti sul socket
+    std::size_t Pending() const
+    {
+        boost::lock_guard< boost::mutex > lock( mtx );
+        return PendingLocked();
+    }
+
+    // frame scartati perche' la connessione era chiusa o il buffer pieno
+    unsigned long Dropped() const
+    {
+        return dropped.load( boost::memory_order_relaxed );
+    }
+
+    // frame ricevuti con un tag senza receiver
+    unsigned long Discarded() const
+    {
+        return discarded.load( boost::memory_order_relaxed );
+    }
+
+    const std::string& Address() const
+    {
+        return address;
+    }
+
+private:
+    enum { MaxPending = 16 * 1024 * 1024 };
+    enum { MaxFrame = 64 * 1024 * 1024 };
+    enum { ReadSize = 64 * 1024 };
+
+    // intestazione di un frame, in network byte order
+    struct Frame
+    {
+        boost::uint32_t size;
+        boost::uint32_t tag;
+    };
+
+    typedef std::map< boost::uint32_t, Receiver > Receivers;
+
+    // indirizzo di socket() e connect()/bind() ricavato da "host:porta" o "unix:percorso"
+    class SocketAddress
+    {
+    public:
+        explicit SocketAddress( const std::string& address ) : length( 0 )
+        {
+            std::memset( &storage, 0, sizeof( storage ) );
+            if ( address.compare( 0, 5, "unix:" ) == 0 )
+            {
+                path = address.substr( 5 );
+                sockaddr_un* un = reinterpret_cast< sockaddr_un* >( &storage );
+                if ( path.empty() || path.size() >= sizeof( un -> sun_path ) )
+                    throw std::invalid_argument( "SocketLink: bad unix socket path in " + address );
+                un -> sun_family = AF_UNIX;
+                std::memcpy( un -> sun_path, path.c_str(), path.size() + 1 );
+                length = sizeof( sockaddr_un );
+                return;
+            }
+            const std::string::size_type colon = address.rfind( ':' );
+            if ( colon == std::string::npos )
+                throw std::invalid_argument( "SocketLink: address " + address + " is not host:port or unix:path" );
+            addrinfo hints = addrinfo();
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* found = NULL;
+            const int error = ::getaddrinfo( address.substr( 0, colon ).c_str(), address.substr( colon + 1 ).c_str(), &hints, &found );
+            if ( error != 0 || !found )
+                throw std::invalid_argument( "SocketLink: cannot resolve " + address + ": " + gai_strerror( error ) );
+            std::memcpy( &storage, found -> ai_addr, found -> ai_addrlen );
+            length = found -> ai_addrlen;
+            ::freeaddrinfo( found );
+        }
+        int Family() const { return storage.ss_family; }
+        const sockaddr* Get() const { return reinterpret_cast< const sockaddr* >( &storage ); }
+        socklen_t Length() const { return length; }
+        // il file di un socket Unix va tolto prima di bind e dopo l'uso
+        void Unlink() const
+        {
+            if ( !path.empty() )
+                ::unlink( path.c_str() );
+        }
+    private:
+        sockaddr_storage storage;
+        socklen_t length;
+        std::string path;
+    };
+
+    SocketLink( boost::shared_ptr< EventBus > b, int f, const std::string& a ) :
+        bus( b ),
+        address( a ),
+        fd( f ),
+        sent( 0 ),
+        flushing( false ),
+        writable( false ),
+        input( ReadSize ),
+        used( 0 ),
+        dropped( 0 ),
+        discarded( 0 )
+    {
+    }
+
+    static boost::shared_ptr< SocketLink > Start( boost::shared_ptr< EventBus > bus, int fd, const std::string& address )
+    {
+        const int flags = ::fcntl( fd, F_GETFL );
+        if ( flags < 0 || ::fcntl( fd, F_SETFL, flags | O_NONBLOCK ) < 0 )
+        {
+            const int error = errno;
+            ::close( fd );
+            Fail( error, "SocketLink" );
+        }
+        // i frame vengono gia' raggruppati da SocketLink: Nagle aggiungerebbe solo ritardo
+        const int on = 1;
+        ::setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+        const boost::shared_ptr< SocketLink > link( new SocketLink( bus, fd, address ) );
+        link -> Watch( Poller::Readable );
+        return link;
+    }
+
+    void Watch( unsigned events )
+    {
+        bus -> Watch( fd.load( boost::memory_order_relaxed ), events,
+            boost::bind( &SocketLink::Ready, boost::weak_ptr< SocketLink >( shared_from_this() ), _1 ) );
+    }
+
+    // il bus puo' invocare Ready e Flush dopo la distruzione del link
+    static void Ready( const boost::weak_ptr< SocketLink >& l, unsigned events )
+    {
+        if ( const boost::shared_ptr< SocketLink > link = l.lock() )
+        {
+            if ( events & Poller::Writable )
+                link -> Write();
+            if ( events & ~Poller::Writable )
+                link -> Read();
+        }
+    }
+
+    static void Flush( const boost::weak_ptr< SocketLink >& l )
+    {
+        if ( const boost::shared_ptr< SocketLink > link = l.lock() )
+            link -> Write();
+    }
+
+    std::size_t PendingLocked() const
+    {
+        return sending.size() - sent + pending.size();
+    }
+
+    // Scrive con writev il resto del buffer in scrittura e quello dei frame accodati
+    // nel frattempo; se il socket e' pieno continua quando torna scrivibile.
+    void Write()
+    {
+        int error = 0;
+        {
+            boost::lock_guard< boost::mutex > lock( mtx );
+            const int s = fd.load( boost::memory_order_relaxed );
+            if ( s < 0 )
+                return;
+            for ( ;; )
+            {
+                iovec v[ 2 ];
+                int n = 0;
+                if ( sent < sending.size() )
+                {
+                    v[ n ].iov_base = &sending[ sent ];
+                    v[ n++ ].iov_len = sending.size() - sent;
+                }
+                if ( !pending.empty() )
+                {
+                    v[ n ].iov_base = &pending[ 0 ];
+                    v[ n++ ].iov_len = pending.size();
+                }
+                if ( n == 0 )
+                {
+                    flushing = false;
+                    if ( writable )
+                    {
+                        writable = false;
+                        Watch( Poller::Readable );
+                    }
+                    return;
+                }
+                const ssize_t written = ::writev( s, v, n );
+                if ( written >= 0 )
+                {
+                    Advance( static_cast< std::size_t >( written ) );
+                    continue;
+                }
+                if ( errno == EINTR )
+                    continue;
+                if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                {
+                    if ( !writable )
+                    {
+                        writable = true;
+                        Watch( Poller::Readable | Poller::Writable );
+                    }
+                    return;
+                }
+                error = errno;
+                break;
+            }
+        }
+        Shutdown( error, true );
+    }
+
+    // i due buffer si scambiano: la memoria viene riusata
+    void Advance( std::size_t written )
+    {
+        const std::size_t left = sending.size() - sent;
+        if ( written < left )
+            sent += written;
+        else
+        {
+            sending.swap( pending );
+            pending.clear();
+            sent = written - left;
+        }
+        if ( sent == sending.size() )
+        {
+            sending.clear();
+            sent = 0;
+        }
+    }
+
+    // legge quello che c'e' e passa ai receiver i frame completi
+    void Read()
+    {
+        const int s = fd.load( boost::memory_order_relaxed );
+        if ( s < 0 )
+            return;
+        if ( input.size() - used < ReadSize / 4 )
+            input.resize( input.size() * 2 );
+        const ssize_t got = ::read( s, &input[ used ], input.size() - used );
+        if ( got <= 0 )
+        {
+            if ( got < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) )
+                return;
+            Shutdown( got == 0 ? 0 : errno, true );
+            return;
+        }
+        used += static_cast< std::size_t >( got );
+        std::size_t pos = 0;
+        bool corrupt = false;
+        {
+            boost::lock_guard< boost::mutex > lock( receiversMtx );
+            while ( used - pos >= sizeof( Frame ) )
+            {
+                Frame f;
+                std::memcpy( &f, &input[ pos ], sizeof( Frame ) );
+                f.size = ntohl( f.size );
+                f.tag = ntohl( f.tag );
+                if ( f.size > MaxFrame )
+                {
+                    corrupt = true;
+                    break;
+                }
+                if ( used - pos - sizeof( Frame ) < f.size )
+                {
+                    // il frame non sta nel buffer: lo si allarga
+                    if ( sizeof( Frame ) + f.size > input.size() )
+                        input.resize( sizeof( Frame ) + f.size );
+                    break;
+                }
+                const Receivers::const_iterator r = receivers.find( f.tag );
+                if ( r != receivers.end() )
+                    r -> second( &input[ pos + sizeof( Frame ) ], f.size );
+                else
+                    discarded.fetch_add( 1, boost::memory_order_relaxed );
+                pos += sizeof( Frame ) + f.size;
+            }
+        }
+        if ( corrupt )
+        {
+            Shutdown( EPROTO, true );
+            return;
+        }
+        used -= pos;
+        if ( pos > 0 && used > 0 )
+            std::memmove( &input[ 0 ], &input[ pos ], used );
+    }
+
+    void Shutdown( int error, bool notify )
+    {
+        int s;
+        {
+            boost::lock_guard< boost::mutex > lock( mtx );
+            s = fd.exchange( -1 );
+            sending.clear();
+            pending.clear();
+            sent = 0;
+            flushing = false;
+        }
+        if ( s < 0 )
+            return;
+        bus -> Unwatch( s );
+        ::close( s );
+        if ( notify )
+            bus -> Post( LinkClosed( address, error ) );
+    }
+
+    static void Fail( int error, const char* what )
+    {
+        throw boost::system::system_error( error, boost::system::system_category(), what );
+    }
+
+    const boost::shared_ptr< EventBus > bus;
+    const std::string address;
+    boost::atomic< int > fd;
+
+    // uscita: sending e' in scrittura (fino a sent), pending raccoglie i nuovi frame
+    mutable boost::mutex mtx;
+    std::vector< char > sending;
+    std::size_t sent;
+    std::vector< char > pending;
+    bool flushing;
+    bool writable;
+
+    // ingresso (solo dal thread del bus)
+    std::vector< char > input;
+    std::size_t used;
+    boost::mutex receiversMtx;
+    Receivers receivers;
+
+    boost::atomic< unsigned long > dropped;
+    boost::atomic< unsigned long > discarded;
+};
+
+} // namespace echidna
+
+#endif // ECHIDNA_HAS_POLLER
+
+#endif // ECHIDNA_SOCKETTRANSPORT_H_
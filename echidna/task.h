@@ -0,0 +1,257 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_TASK_H_
+#define ECHIDNA_TASK_H_
+
+#include <cassert>
+#include <map>
+#include <boost/bind.hpp>
+#include <boost/coroutine/asymmetric_coroutine.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+#include "envelope.h"
+#include "eventbus.h"
+#include "request.h"
+
+namespace echidna
+{
+
+// Flusso di lavoro a piu' passi (attendi un evento, aspetta, fai una richiesta...)
+// scritto come codice sequenziale invece che come catena di handler.
+// Il corpo del task gira in una coroutine (boost::coroutines, con uno stack proprio):
+// Next, Sleep, Yield e Request la sospendono e ritornano quando il bus la riprende.
+// Non ci sono thread dedicati: il task viene ripreso direttamente dal thread che
+// consegna l'evento o che fa scattare il timer (con il pool di thread, nello strand
+// del task, quindi il corpo non viene mai eseguito in parallelo con se stesso).
+// Il corpo non deve bloccare a lungo: blocca il thread che lo ha ripreso.
+class Task : public boost::enable_shared_from_this< Task >, private boost::noncopyable
+{
+public:
+    typedef boost::function< void ( Task& ) > Body;
+    typedef EventBus::Clock Clock;
+
+    // Crea il task: il corpo parte dal thread che lo riprende anche in seguito, cioe'
+    // quello che esegue Run/Poll (o, con il pool di thread, nello strand del task),
+    // quindi in genere dopo che Spawn ha ritornato.
+    // Con il pool di thread il task usa lo strand dello StrandScope attivo (es. la
+    // mailbox del componente che lo crea, vedi Container) o, se non c'e', uno nuovo.
+    // Il task resta in vita finche' aspetta qualcosa (o finche' esiste il puntatore ritornato).
+    static boost::shared_ptr< Task > Spawn( EventBus& bus, Body body )
+    {
+        return Spawn( bus, body, bus.ScopedStrand() );
+    }
+
+    // Come sopra, ma il task viene ripreso nello strand indicato: il corpo non viene
+    // eseguito in parallelo con gli altri handler sottoscritti con lo stesso strand.
+    static boost::shared_ptr< Task > Spawn( EventBus& bus, Body body, EventBus::StrandPtr strand )
+    {
+        boost::shared_ptr< Task > task( new Task( bus, body, strand ) );
+        // Se il corpo partisse dal thread che invoca Spawn, un evento consegnato
+        // mentre si sta sospendendo lo riprenderebbe in parallelo dal thread di Run.
+        if ( task -> strand )
+            task -> Continue();
+        else
+            task -> Defer();
+        return task;
+    }
+
+    EventBus& Bus() { return bus; }
+
+    // true quando il corpo e' terminato
+    bool Done() const { return !coroutine; }
+
+    // Aspetta il prossimo evento di tipo E (o derivato) consegnato dal bus
+    // e ne ritorna una copia. Gli eventi consegnati mentre il task non aspetta E
+    // non vengono ricevuti. La sottoscrizione resta attiva fino alla fine del task.
+    template < typename E >
+    typename HandlerFunction< E >::Event Next()
+    {
+        typedef typename HandlerFunction< E >::Event Event;
+        const std::size_t id = EventTypeId< Event >::Value();
+        if ( subscriptions.find( id ) == subscriptions.end() )
+            subscriptions[ id ] = bus.Subscribe< Event >( boost::bind( &Task::Receive< Event >, shared_from_this(), _1 ), strand );
+        waiting = true;
+        waitingFor = id;
+        Suspend();
+        const Event e = *received.As< Event >();
+        received = Envelope();
+        return e;
+    }
+
+    // riprende dopo delay
+    void Sleep( Clock::duration delay )
+    {
+        bus.CallAfter( boost::bind( &Task::Continue, shared_from_this() ), delay );
+        Suspend();
+    }
+
+    // Riprende dopo che il bus ha preso in carico gli eventi gia' accodati
+    // (ad esempio quelli appena postati dal task).
+    void Yield()
+    {
+        Defer();
+        Suspend();
+    }
+
+    // Come EventBus::Request, ma ritorna direttamente la risposta
+    // (o lancia l'eccezione ricevuta, boost::broken_promise se nessuno risponde).
+    template < typename Rep, typename Req >
+    Rep Request( const Req& req )
+    {
+        boost::shared_future< Rep > result;
+        // il task non deve tenere in vita la richiesta (vedi ~QueryState)
+        {
+            const boost::shared_ptr< QueryState< Rep > > state( new QueryState< Rep >() );
+            result = Ask( req, state );
+        }
+        Suspend();
+        return result.get();
+    }
+
+    // Come sopra, ma dopo timeout lancia RequestTimeout.
+    template < typename Rep, typename Req >
+    Rep Request( const Req& req, Clock::duration timeout )
+    {
+        boost::shared_future< Rep > result;
+        {
+            const boost::shared_ptr< QueryState< Rep > > state( new QueryState< Rep >() );
+            const EventBus::Timer timer = bus.CallAfter( boost::bind( &QueryState< Rep >::Expire, state ), timeout );
+            // quando arriva la risposta il timeout viene annullato
+            state -> OnResult( timer.Canceller() );
+            result = Ask( req, state );
+        }
+        Suspend();
+        return result.get();
+    }
+
+private:
+    typedef boost::coroutines::asymmetric_coroutine< void > Coroutine;
+
+    Task( EventBus& _bus, Body _body, EventBus::StrandPtr _strand ) :
+        bus( _bus ),
+        body( _body ),
+        strand( !bus.Pooled( _strand ) ? EventBus::StrandPtr() : _strand ? _strand : bus.NewStrand() ),
+        coroutine( new Coroutine::push_type( boost::bind( &Task::Run, this, _1 ) ) ),
+        caller( NULL ),
+        waiting( false ),
+        waitingFor( 0 )
+    {
+    }
+
+    void Run( Coroutine::pull_type& c )
+    {
+        caller = &c;
+        body( *this );
+    }
+
+    // torna a chi ha ripreso il task
+    void Suspend()
+    {
+        assert( caller );
+        ( *caller )();
+    }
+
+    // riprende il task dopo gli eventi gia' accodati, dal thread di Run (o nel suo strand)
+    void Defer()
+    {
+        if ( !bus.Call( boost::bind( &Task::Continue, shared_from_this() ) ) )
+            bus.CallAfter( boost::bind( &Task::Continue, shared_from_this() ), Clock::duration::zero() );
+    }
+
+    // riprende il task dal thread corrente (o nel suo strand)
+    void Continue()
+    {
+        if ( strand )
+            strand -> dispatch( boost::bind( &Task::Resume, shared_from_this() ) );
+        else
+            Resume();
+    }
+
+    void Resume()
+    {
+        // le sottoscrizioni tengono in vita il task: lo si fa anche qui, finche' servono
+        const boost::shared_ptr< Task > self( shared_from_this() );
+        if ( !coroutine )
+            return;
+        try
+        {
+            ( *coroutine )();
+        }
+        catch ( ... )
+        {
+            Finish();
+            throw;
+        }
+        if ( !*coroutine )
+            Finish();
+    }
+
+    void Finish()
+    {
+        for ( Subscriptions::iterator i = subscriptions.begin(); i != subscriptions.end(); ++i )
+            i -> second.Disconnect();
+        subscriptions.clear();
+        coroutine.reset();
+    }
+
+    template < typename E >
+    void Receive( const E& e )
+    {
+        if ( !waiting || waitingFor != EventTypeId< E >::Value() )
+            return;
+        waiting = false;
+        received = Envelope( e );
+        Resume();
+    }
+
+    // il task viene ripreso quando arriva la risposta (passando dal thread di Run)
+    template < typename Rep, typename Req >
+    boost::shared_future< Rep > Ask( const Req& req, const boost::shared_ptr< QueryState< Rep > >& state )
+    {
+        const boost::shared_future< Rep > result = state -> Future();
+        state -> OnDone( boost::bind( &EventBus::CallAfter, &bus,
+            boost::function< void () >( boost::bind( &Task::Continue, shared_from_this() ) ), Clock::duration::zero() ) );
+        bus.Post( Query< Req, Rep >( req, state ) );
+        return result;
+    }
+
+    typedef std::map< std::size_t, EventBus::Subscription > Subscriptions;
+
+    EventBus& bus;
+    const Body body;
+    const EventBus::StrandPtr strand; // vuoto se il task viene ripreso dal thread di Run
+    boost::scoped_ptr< Coroutine::push_type > coroutine; // vuoto quando il corpo e' terminato
+    Coroutine::pull_type* caller;
+    Subscriptions subscriptions; // per tipo di evento
+    bool waiting;
+    std::size_t waitingFor; // tipo atteso da Next
+    Envelope received;
+};
+
+} // namespace echidna
+
+#endif // ECHIDNA_TASK_H_
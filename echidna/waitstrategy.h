@@ -0,0 +1,70 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+#ifndef ECHIDNA_WAITSTRATEGY_H_
+#define ECHIDNA_WAITSTRATEGY_H_
+
+#include <boost/chrono.hpp>
+
+#if defined( _MSC_VER ) && ( defined( _M_IX86 ) || defined( _M_X64 ) )
+#include <intrin.h>
+#endif
+
+namespace echidna
+{
+
+// Come il consumatore dell'EventBus (il thread che esegue Run)
+// aspetta che arrivi un evento.
+struct WaitStrategy
+{
+    enum Mode
+    {
+        Block, // si addormenta subito (condition variable o epoll)
+        Park,  // controlla la coda attivamente per budget, poi si addormenta
+        Yield, // controlla la coda attivamente per budget, poi cedendo il processore
+        Spin   // controlla sempre la coda attivamente (occupa un core)
+    };
+
+    WaitStrategy() : mode( Block ), budget( boost::chrono::microseconds( 50 ) ) {}
+    WaitStrategy( Mode m, boost::chrono::steady_clock::duration b ) : mode( m ), budget( b ) {}
+
+    Mode mode;
+    boost::chrono::steady_clock::duration budget; // ignorato da Block e Spin
+};
+
+// Segnala al processore che si sta aspettando attivamente
+// (sugli x86 libera risorse per l'altro thread dello stesso core).
+inline void CpuRelax()
+{
+#if defined( __GNUC__ ) && ( defined( __i386__ ) || defined( __x86_64__ ) )
+    __builtin_ia32_pause();
+#elif defined( __GNUC__ ) && defined( __aarch64__ )
+    __asm__ __volatile__( "yield" );
+#elif defined( _MSC_VER ) && ( defined( _M_IX86 ) || defined( _M_X64 ) )
+    _mm_pause();
+#endif
+}
+
+} // namespace echidna
+
+#endif // ECHIDNA_WAITSTRATEGY_H_
@@ -0,0 +1,103 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Confronta Post di un evento alla volta con PostMany di blocchi di eventi,
+// con il consumatore in esecuzione su un altro thread.
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "echidna/eventbus.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+struct Tick
+{
+    explicit Tick( unsigned s = 0 ) : seq( s ) {}
+    unsigned seq;
+};
+
+const unsigned long Events = 2000000;
+
+unsigned long received = 0;
+
+void OnTick( const Tick& )
+{
+    ++received;
+}
+
+void Consume( EventBus* bus )
+{
+    while ( received < Events )
+        bus -> Run();
+}
+
+double Measure( unsigned burst )
+{
+    EventBus bus;
+    bus.Subscribe< Tick >( OnTick );
+    received = 0;
+
+    std::vector< Tick > events( burst );
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    boost::thread consumer( boost::bind( Consume, &bus ) );
+
+    for ( unsigned long sent = 0; sent < Events; sent += burst )
+    {
+        if ( burst == 1 )
+            bus.Post( Tick( sent ) );
+        else
+        {
+            for ( unsigned i = 0; i < burst; ++i )
+                events[ i ].seq = sent + i;
+            bus.PostMany( events.begin(), events.end() );
+        }
+    }
+
+    consumer.join();
+    const boost::posix_time::time_duration elapsed =
+        boost::posix_time::microsec_clock::universal_time() - start;
+    return Events / ( elapsed.total_microseconds() / 1000000.0 );
+}
+
+} // namespace
+
+int main()
+{
+    const unsigned bursts[] = { 1, 16, 64, 256 };
+
+    cout << "    burst     events/sec" << endl;
+    for ( unsigned i = 0; i < sizeof( bursts ) / sizeof( bursts[ 0 ] ); ++i )
+        cout << setw( 9 ) << bursts[ i ] << setw( 15 ) << fixed << setprecision( 0 )
+             << Measure( bursts[ i ] ) << endl;
+
+    return 0;
+}
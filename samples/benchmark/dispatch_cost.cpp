@@ -0,0 +1,99 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Misura il costo del dispatch di un evento al variare del numero
+// di tipi di evento sottoscritti sul bus.
+
+#include <iostream>
+#include <iomanip>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "echidna/eventbus.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+template < int N >
+struct Ev {};
+
+unsigned long received = 0;
+
+template < int N >
+void OnEv( Ev< N > )
+{
+    ++received;
+}
+
+// sottoscrive gli eventi Ev< 0 > ... Ev< N - 1 >
+template < int N >
+struct SubscribeAll
+{
+    static void To( EventBus& bus )
+    {
+        SubscribeAll< N - 1 >::To( bus );
+        bus.Subscribe< Ev< N - 1 > >( OnEv< N - 1 > );
+    }
+};
+
+template <>
+struct SubscribeAll< 0 >
+{
+    static void To( EventBus& ) {}
+};
+
+const unsigned Events = 1000000;
+
+// ritorna i nanosecondi necessari per il dispatch di un evento
+template < int Types >
+double Measure()
+{
+    EventBus bus;
+    SubscribeAll< Types >::To( bus );
+    received = 0;
+
+    // si usa sempre l'ultimo tipo registrato
+    for ( unsigned i = 0; i < Events; ++i )
+        bus.Post( Ev< Types - 1 >() );
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    bus.Poll();
+    const boost::posix_time::time_duration elapsed =
+        boost::posix_time::microsec_clock::universal_time() - start;
+
+    return elapsed.total_microseconds() * 1000.0 / Events;
+}
+
+} // namespace
+
+int main()
+{
+    cout << "    types      ns/event" << endl;
+    cout << setw( 9 ) << 1 << setw( 14 ) << fixed << setprecision( 1 ) << Measure< 1 >() << endl;
+    cout << setw( 9 ) << 10 << setw( 14 ) << Measure< 10 >() << endl;
+    cout << setw( 9 ) << 100 << setw( 14 ) << Measure< 100 >() << endl;
+    cout << setw( 9 ) << 500 << setw( 14 ) << Measure< 500 >() << endl;
+
+    return 0;
+}
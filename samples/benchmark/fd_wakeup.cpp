@@ -0,0 +1,182 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Confronta la latenza con cui un dato che arriva da un file descriptor
+// (una pipe) raggiunge l'handler di un altro thread:
+//  - un thread dedicato legge la pipe e fa Post verso il thread che esegue Run
+//  - il thread che esegue Run aspetta la pipe con EventBus::Watch (solo Linux)
+// e quella di un Post verso il thread che esegue Run, svegliato
+// dalla condition variable o dall'eventfd (dopo Watch).
+
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "echidna/eventbus.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+struct Ping
+{
+    explicit Ping( unsigned s ) : seq( s ) {}
+    unsigned seq;
+};
+
+const unsigned Events = 100000;
+
+boost::atomic< unsigned > handled( 0 );
+
+void OnPing( const Ping& p )
+{
+    handled.store( p.seq + 1, boost::memory_order_release );
+}
+
+void Consume( EventBus* bus )
+{
+    while ( handled.load( boost::memory_order_acquire ) < Events )
+        bus -> Run();
+}
+
+// thread dedicato: legge la pipe e inoltra sul bus
+void Read( int fd, EventBus* bus )
+{
+    unsigned seq;
+    while ( read( fd, &seq, sizeof( seq ) ) == sizeof( seq ) )
+        bus -> Post( Ping( seq ) );
+}
+
+#ifdef ECHIDNA_HAS_POLLER
+// handler di Watch: legge la pipe dal thread che esegue Run
+void OnReadable( int fd, unsigned )
+{
+    unsigned seq;
+    if ( read( fd, &seq, sizeof( seq ) ) == sizeof( seq ) )
+        OnPing( Ping( seq ) );
+}
+#endif
+
+class Stopwatch
+{
+public:
+    Stopwatch() : start( boost::posix_time::microsec_clock::universal_time() ) {}
+    // nanosecondi per evento
+    double PerEvent() const
+    {
+        const boost::posix_time::time_duration elapsed =
+            boost::posix_time::microsec_clock::universal_time() - start;
+        return elapsed.total_microseconds() * 1000.0 / Events;
+    }
+private:
+    const boost::posix_time::ptime start;
+};
+
+// si aspetta che ogni evento sia stato gestito prima di mandare il successivo
+void WaitHandled( unsigned i )
+{
+    while ( handled.load( boost::memory_order_acquire ) <= i )
+        boost::this_thread::yield();
+}
+
+double ThroughPipe( bool watch )
+{
+    int fds[ 2 ];
+    if ( pipe( fds ) != 0 )
+        return 0;
+    EventBus bus;
+    bus.Subscribe< Ping >( OnPing );
+    handled = 0;
+    boost::thread reader;
+#ifdef ECHIDNA_HAS_POLLER
+    if ( watch )
+        bus.Watch( fds[ 0 ], Poller::Readable, boost::bind( OnReadable, fds[ 0 ], _1 ) );
+    else
+#endif
+        reader = boost::thread( boost::bind( Read, fds[ 0 ], &bus ) );
+    boost::thread consumer( boost::bind( Consume, &bus ) );
+    Stopwatch sw;
+    for ( unsigned i = 0; i < Events; ++i )
+    {
+        if ( write( fds[ 1 ], &i, sizeof( i ) ) != sizeof( i ) )
+            break;
+        WaitHandled( i );
+    }
+    const double result = sw.PerEvent();
+    consumer.join();
+    close( fds[ 1 ] );
+    if ( reader.joinable() )
+        reader.join();
+    close( fds[ 0 ] );
+    return result;
+}
+
+double PostToOtherThread( bool watch )
+{
+    int fds[ 2 ];
+    if ( pipe( fds ) != 0 )
+        return 0;
+    EventBus bus;
+    bus.Subscribe< Ping >( OnPing );
+    handled = 0;
+#ifdef ECHIDNA_HAS_POLLER
+    // basta un file descriptor qualsiasi perche' il bus aspetti con epoll
+    if ( watch )
+        bus.Watch( fds[ 0 ], Poller::Readable, boost::bind( OnReadable, fds[ 0 ], _1 ) );
+#endif
+    boost::thread consumer( boost::bind( Consume, &bus ) );
+    Stopwatch sw;
+    for ( unsigned i = 0; i < Events; ++i )
+    {
+        bus.Post( Ping( i ) );
+        WaitHandled( i );
+    }
+    const double result = sw.PerEvent();
+    consumer.join();
+    close( fds[ 0 ] );
+    close( fds[ 1 ] );
+    return result;
+}
+
+} // namespace
+
+int main()
+{
+    cout << fixed << setprecision( 1 );
+    cout << "delivery                          ns/event" << endl;
+    cout << "pipe -> reader thread -> Post " << setw( 12 ) << ThroughPipe( false ) << endl;
+#ifdef ECHIDNA_HAS_POLLER
+    cout << "pipe -> Watch                 " << setw( 12 ) << ThroughPipe( true ) << endl;
+#endif
+    cout << "Post (condition variable)     " << setw( 12 ) << PostToOtherThread( false ) << endl;
+#ifdef ECHIDNA_HAS_POLLER
+    cout << "Post (eventfd)                " << setw( 12 ) << PostToOtherThread( true ) << endl;
+#endif
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Misura quanto costa registrare un evento nel Journal: il tempo di Send
+// di un evento piccolo senza journal, con il journal e con un handler vuoto
+// (per confronto), e il tempo per rileggere i record con JournalReader.
+// I segmenti vengono scritti nella directory corrente e poi cancellati.
+
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/make_shared.hpp>
+#include "echidna/journal.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+struct Quote
+{
+    Quote( unsigned s, double b, double a ) : seq( s ), bid( b ), ask( a ) {}
+    unsigned seq;
+    double bid;
+    double ask;
+};
+
+void Handle( const Quote& ) {}
+
+const unsigned Events = 1000000;
+const char* Path = "journal_append";
+
+class Stopwatch
+{
+public:
+    Stopwatch() : start( boost::posix_time::microsec_clock::universal_time() ) {}
+    // nanosecondi per evento
+    double PerEvent() const
+    {
+        const boost::posix_time::time_duration elapsed =
+            boost::posix_time::microsec_clock::universal_time() - start;
+        return elapsed.total_microseconds() * 1000.0 / Events;
+    }
+private:
+    const boost::posix_time::ptime start;
+};
+
+double SendAll( EventBus& bus )
+{
+    Stopwatch sw;
+    for ( unsigned i = 0; i < Events; ++i )
+        bus.Send( Quote( i, 1.5, 1.75 ) );
+    return sw.PerEvent();
+}
+
+struct Count
+{
+    Count() : quotes( 0 ) {}
+    void operator()( const JournalRecord& r )
+    {
+        if ( r.tag == EventTag( "Quote" ) && PodCodec< Quote >::Decode( r.data, r.size ).seq == quotes )
+            ++quotes;
+    }
+    unsigned quotes;
+};
+
+void RemoveSegments()
+{
+    for ( unsigned n = 1; JournalSegment::Exists( JournalSegment::Name( Path, n ) ); ++n )
+        std::remove( JournalSegment::Name( Path, n ).c_str() );
+}
+
+} // namespace
+
+int main()
+{
+    RemoveSegments();
+    cout << fixed << setprecision( 1 );
+    cout << "                       ns/event" << endl;
+    {
+        const boost::shared_ptr< EventBus > bus = boost::make_shared< EventBus >();
+        bus -> Subscribe< Quote >( Handle );
+        cout << "handler          " << setw( 14 ) << SendAll( *bus ) << endl;
+    }
+    {
+        const boost::shared_ptr< EventBus > bus = boost::make_shared< EventBus >();
+        bus -> Subscribe< Quote >( Handle );
+        Journal journal( bus, Path, 16 * 1024 * 1024 );
+        journal.Record< Quote >( "Quote" );
+        cout << "handler + journal" << setw( 14 ) << SendAll( *bus ) << endl;
+        if ( journal.Dropped() > 0 )
+            cout << journal.Dropped() << " events dropped" << endl;
+    }
+    {
+        Count count;
+        Stopwatch sw;
+        JournalReader( Path ).ForEach( count );
+        cout << "read back        " << setw( 14 ) << sw.PerEvent() << endl;
+        if ( count.quotes != Events )
+            cout << "read " << count.quotes << " of " << Events << " events" << endl;
+    }
+    RemoveSegments();
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Confronta il costo del dispatch di un comando (std::string) con N sottoscrizioni
+// filtrate da un predicato e con N sottoscrizioni con chiave (SubscribeKey).
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "echidna/eventbus.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+unsigned long received = 0;
+
+void OnCommand( const string& )
+{
+    ++received;
+}
+
+bool Equals( const string& expected, const string& cmd )
+{
+    return cmd == expected;
+}
+
+const unsigned Events = 200000;
+
+vector< string > Commands( unsigned n )
+{
+    vector< string > commands;
+    for ( unsigned i = 0; i < n; ++i )
+    {
+        ostringstream name;
+        name << "command" << i;
+        commands.push_back( name.str() );
+    }
+    return commands;
+}
+
+// ritorna i nanosecondi necessari per il dispatch di un comando
+double Measure( unsigned handlers, bool keyed )
+{
+    EventBus bus;
+    const vector< string > commands = Commands( handlers );
+    for ( vector< string >::const_iterator i = commands.begin(); i != commands.end(); ++i )
+        if ( keyed )
+            bus.SubscribeKey< string >( *i, &OnCommand );
+        else
+            bus.Subscribe< string >( &OnCommand, boost::bind( &Equals, *i, _1 ) );
+    received = 0;
+
+    for ( unsigned i = 0; i < Events; ++i )
+        bus.Post( commands[ i % handlers ] );
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    bus.Poll();
+    const boost::posix_time::time_duration elapsed =
+        boost::posix_time::microsec_clock::universal_time() - start;
+
+    return elapsed.total_microseconds() * 1000.0 / Events;
+}
+
+} // namespace
+
+int main()
+{
+    const unsigned handlers[] = { 1, 10, 100, 500 };
+
+    cout << " handlers  predicate ns/event  keyed ns/event" << endl;
+    for ( unsigned i = 0; i < sizeof( handlers ) / sizeof( handlers[ 0 ] ); ++i )
+        cout << setw( 9 ) << handlers[ i ]
+             << setw( 20 ) << fixed << setprecision( 1 ) << Measure( handlers[ i ], false )
+             << setw( 16 ) << Measure( handlers[ i ], true ) << endl;
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Confronta il costo del dispatch di un evento da 4 KB verso un handler
+// che lo riceve per valore e verso uno che lo riceve per riferimento costante.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "echidna/eventbus.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+struct MarketData
+{
+    MarketData() { for ( unsigned i = 0; i < Levels; ++i ) price[ i ] = i; }
+    enum { Levels = 512 };
+    double price[ Levels ];
+};
+
+double sum = 0;
+
+void ByValue( MarketData md )
+{
+    sum += md.price[ 0 ];
+}
+
+void ByReference( const MarketData& md )
+{
+    sum += md.price[ 0 ];
+}
+
+const unsigned Events = 1000; // meno della capacita' della coda
+const unsigned Rounds = 200;
+
+// ritorna i nanosecondi necessari per il dispatch di un evento
+template < typename H >
+double Measure( H handler )
+{
+    EventBus bus;
+    bus.Subscribe< MarketData >( handler );
+    const MarketData md;
+
+    boost::posix_time::time_duration elapsed;
+    for ( unsigned r = 0; r < Rounds; ++r )
+    {
+        for ( unsigned i = 0; i < Events; ++i )
+            bus.Post( md );
+
+        const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+        bus.Poll();
+        elapsed += boost::posix_time::microsec_clock::universal_time() - start;
+    }
+
+    return elapsed.total_microseconds() * 1000.0 / ( Events * Rounds );
+}
+
+} // namespace
+
+int main()
+{
+    cout << "event size: " << sizeof( MarketData ) << " bytes" << endl;
+    cout << "      handler      ns/event" << endl;
+    cout << setw( 13 ) << "by value" << setw( 14 ) << fixed << setprecision( 1 ) << Measure( ByValue ) << endl;
+    cout << setw( 13 ) << "by reference" << setw( 14 ) << Measure( ByReference ) << endl;
+
+    return 0;
+}
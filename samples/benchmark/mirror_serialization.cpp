@@ -0,0 +1,197 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Confronta il costo (tempo e allocazioni) di rispecchiare un evento con EventMirror
+// usando un serializzatore a stringhe e usando un codec (vedi codec.h):
+//  - stringa di testo, scritta e letta con gli stream
+//  - stringa con i campi in binario
+//  - codec generato con ECHIDNA_STRUCT_CODEC
+// Il link passa subito i byte al mirror in ingresso, che posta l'evento su un secondo bus:
+// si misura solo la serializzazione (il Post sul secondo bus e' comune a tutti).
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/make_shared.hpp>
+#include "echidna/eventmirror.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+unsigned long allocations = 0;
+
+struct Order
+{
+    Order() : id( 0 ), price( 0 ), quantity( 0 ) {}
+    unsigned id;
+    std::string symbol;
+    double price;
+    unsigned quantity;
+};
+
+struct TextSerializer
+{
+    static std::string ToStream( const Order& o )
+    {
+        std::ostringstream os;
+        os << o.id << ' ' << o.symbol << ' ' << o.price << ' ' << o.quantity;
+        return os.str();
+    }
+    static Order FromStream( const std::string& s )
+    {
+        std::istringstream is( s );
+        Order o;
+        is >> o.id >> o.symbol >> o.price >> o.quantity;
+        return o;
+    }
+};
+
+struct BinaryStringSerializer
+{
+    static std::string ToStream( const Order& o )
+    {
+        std::string s;
+        const boost::uint32_t length = static_cast< boost::uint32_t >( o.symbol.size() );
+        s.append( reinterpret_cast< const char* >( &o.id ), sizeof( o.id ) );
+        s.append( reinterpret_cast< const char* >( &length ), sizeof( length ) );
+        s.append( o.symbol );
+        s.append( reinterpret_cast< const char* >( &o.price ), sizeof( o.price ) );
+        s.append( reinterpret_cast< const char* >( &o.quantity ), sizeof( o.quantity ) );
+        return s;
+    }
+    static Order FromStream( const std::string& s )
+    {
+        Order o;
+        const char* in = s.data();
+        boost::uint32_t length;
+        memcpy( &o.id, in, sizeof( o.id ) ); in += sizeof( o.id );
+        memcpy( &length, in, sizeof( length ) ); in += sizeof( length );
+        o.symbol.assign( in, length ); in += length;
+        memcpy( &o.price, in, sizeof( o.price ) ); in += sizeof( o.price );
+        memcpy( &o.quantity, in, sizeof( o.quantity ) );
+        return o;
+    }
+};
+
+ECHIDNA_STRUCT_CODEC( OrderCodec, Order, (id)(symbol)(price)(quantity) );
+
+// passa i byte inviati al receiver dello stesso tag, dal thread che invia
+class LoopbackLink : public MirrorLink
+{
+public:
+    virtual bool Send( boost::uint32_t tag, const char* data, std::size_t size )
+    {
+        const Receivers::const_iterator r = receivers.find( tag );
+        if ( r == receivers.end() )
+            return false;
+        r -> second( data, size );
+        return true;
+    }
+    virtual void SetReceiver( boost::uint32_t tag, Receiver r )
+    {
+        receivers[ tag ] = r;
+    }
+    virtual void ClearReceiver( boost::uint32_t tag )
+    {
+        receivers.erase( tag );
+    }
+private:
+    typedef std::map< boost::uint32_t, Receiver > Receivers;
+    Receivers receivers;
+};
+
+unsigned received = 0;
+
+void Handle( const Order& )
+{
+    ++received;
+}
+
+const unsigned Events = 100000;
+const unsigned Block = 1000; // meno della capacita' della coda
+
+template < typename S >
+void Measure( const string& name )
+{
+    const boost::shared_ptr< EventBus > from = boost::make_shared< EventBus >();
+    const boost::shared_ptr< EventBus > to = boost::make_shared< EventBus >();
+    const boost::shared_ptr< MirrorLink > link = boost::make_shared< LoopbackLink >();
+    EventMirror< Order, S > out( from, link, "Order", MirrorLink::Outgoing );
+    EventMirror< Order, S > in( to, link, "Order", MirrorLink::Incoming );
+    to -> Subscribe< Order >( Handle );
+
+    Order o;
+    o.symbol = "ECHIDNA";
+    o.price = 12.5;
+    o.quantity = 100;
+    received = 0;
+
+    const unsigned long before = allocations;
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    for ( unsigned i = 0; i < Events; ++i )
+    {
+        o.id = i;
+        from -> Send( o );
+        if ( i % Block == Block - 1 )
+            to -> Poll();
+    }
+    to -> Poll();
+    const boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+    const unsigned long count = allocations - before;
+
+    cout << setw( 20 ) << name
+         << setw( 12 ) << fixed << setprecision( 1 ) << elapsed.total_microseconds() * 1000.0 / Events
+         << setw( 16 ) << setprecision( 2 ) << double( count ) / Events
+         << ( received == Events ? "" : "  (events lost)" ) << endl;
+}
+
+} // namespace
+
+// l'operator delete di default rilascia la memoria con free
+void* operator new( std::size_t size ) throw ( std::bad_alloc )
+{
+    ++allocations;
+    void* p = std::malloc( size );
+    if ( p == NULL )
+        throw std::bad_alloc();
+    return p;
+}
+
+int main()
+{
+    cout << "          serializer    ns/event    allocs/event" << endl;
+    Measure< TextSerializer >( "text string" );
+    Measure< BinaryStringSerializer >( "binary string" );
+    Measure< OrderCodec >( "codec" );
+
+    return 0;
+}
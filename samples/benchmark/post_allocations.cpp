@@ -0,0 +1,116 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Conta le allocazioni dinamiche fatte da Post e dal dispatch di un evento:
+// gli eventi piccoli non devono allocare nulla. Se lo fanno, il programma
+// lo segnala e termina con un codice di uscita diverso da zero.
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <new>
+#include <string>
+#include "echidna/eventbus.h"
+#include "echidna/exit.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+unsigned long allocations = 0;
+
+struct Token {};
+
+struct Quote
+{
+    Quote() : bid( 0 ), ask( 0 ) {}
+    double bid;
+    double ask;
+};
+
+struct Book
+{
+    Book() { for ( unsigned i = 0; i < sizeof( levels ) / sizeof( levels[ 0 ] ); ++i ) levels[ i ] = i; }
+    double levels[ 32 ];
+};
+
+template < typename E >
+void Handle( const E& ) {}
+
+const unsigned Events = 1000; // meno della capacita' della coda
+
+// ritorna le allocazioni fatte per ogni evento
+template < typename E >
+double Measure( const string& name )
+{
+    EventBus bus;
+    bus.Subscribe< E >( Handle< E > );
+
+    const unsigned long before = allocations;
+    for ( unsigned i = 0; i < Events; ++i )
+        bus.Post( E() );
+    bus.Poll();
+    const unsigned long count = allocations - before;
+
+    const double perEvent = double( count ) / Events;
+    cout << setw( 12 ) << name << setw( 8 ) << sizeof( E )
+         << setw( 16 ) << fixed << setprecision( 2 ) << perEvent << endl;
+    return perEvent;
+}
+
+// gli eventi piccoli non devono allocare
+bool Check( const string& name, double perEvent )
+{
+    if ( perEvent == 0 )
+        return true;
+    cerr << "FAILED: " << name << " allocates " << perEvent << " times per event (expected 0)" << endl;
+    return false;
+}
+
+} // namespace
+
+// l'operator delete di default rilascia la memoria con free
+void* operator new( std::size_t size ) throw ( std::bad_alloc )
+{
+    ++allocations;
+    void* p = std::malloc( size );
+    if ( p == NULL )
+        throw std::bad_alloc();
+    return p;
+}
+
+int main()
+{
+    cout << "       event    size     allocs/event" << endl;
+    const double token = Measure< Token >( "Token" );
+    const double exitEvent = Measure< event::Exit >( "Exit" );
+    const double quote = Measure< Quote >( "Quote" );
+    Measure< Book >( "Book" );
+
+    bool ok = Check( "Token", token );
+    ok = Check( "Exit", exitEvent ) && ok;
+    ok = Check( "Quote", quote ) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Misura quanti Post al secondo riesce a sostenere un EventBus
+// al variare del numero di thread produttori.
+
+#include <iostream>
+#include <iomanip>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "echidna/eventbus.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+struct Tick
+{
+    Tick( unsigned p, unsigned s ) : producer( p ), seq( s ) {}
+    unsigned producer;
+    unsigned seq;
+};
+
+const unsigned PostsPerProducer = 200000;
+
+unsigned long received = 0;
+
+void OnTick( const Tick& )
+{
+    ++received;
+}
+
+void Produce( EventBus* bus, unsigned id )
+{
+    for ( unsigned i = 0; i < PostsPerProducer; ++i )
+        bus -> Post( Tick( id, i ) );
+}
+
+double Measure( unsigned producers )
+{
+    EventBus bus;
+    bus.Subscribe< Tick >( OnTick );
+    received = 0;
+
+    const unsigned long total = static_cast< unsigned long >( producers ) * PostsPerProducer;
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    boost::thread_group threads;
+    for ( unsigned i = 0; i < producers; ++i )
+        threads.create_thread( boost::bind( Produce, &bus, i ) );
+
+    // il thread principale fa da consumatore
+    while ( received < total )
+        bus.Run();
+
+    threads.join_all();
+
+    const boost::posix_time::time_duration elapsed =
+        boost::posix_time::microsec_clock::universal_time() - start;
+    return total / ( elapsed.total_microseconds() / 1000000.0 );
+}
+
+} // namespace
+
+int main()
+{
+    const unsigned producers[] = { 1, 2, 4, 8, 12, 16 };
+
+    cout << "producers      posts/sec" << endl;
+    for ( unsigned i = 0; i < sizeof( producers ) / sizeof( producers[ 0 ] ); ++i )
+        cout << setw( 9 ) << producers[ i ] << setw( 15 ) << fixed << setprecision( 0 )
+             << Measure( producers[ i ] ) << endl;
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Confronta la latenza della consegna tramite coda (Post) con quella
+// della consegna diretta (Send) di un evento alla volta:
+//  - Post + PollOne dallo stesso thread
+//  - Post verso un altro thread che esegue Run (andata e ritorno)
+//  - Send
+
+#include <iostream>
+#include <iomanip>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "echidna/eventbus.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+struct Ping
+{
+    explicit Ping( unsigned s ) : seq( s ) {}
+    unsigned seq;
+};
+
+const unsigned Events = 200000;
+
+boost::atomic< unsigned > handled( 0 );
+
+void OnPing( const Ping& p )
+{
+    handled.store( p.seq + 1, boost::memory_order_release );
+}
+
+void Consume( EventBus* bus )
+{
+    while ( handled.load( boost::memory_order_acquire ) < Events )
+        bus -> Run();
+}
+
+class Stopwatch
+{
+public:
+    Stopwatch() : start( boost::posix_time::microsec_clock::universal_time() ) {}
+    // nanosecondi per evento
+    double PerEvent() const
+    {
+        const boost::posix_time::time_duration elapsed =
+            boost::posix_time::microsec_clock::universal_time() - start;
+        return elapsed.total_microseconds() * 1000.0 / Events;
+    }
+private:
+    const boost::posix_time::ptime start;
+};
+
+double PostAndPoll()
+{
+    EventBus bus;
+    bus.Subscribe< Ping >( OnPing );
+    handled = 0;
+    Stopwatch sw;
+    for ( unsigned i = 0; i < Events; ++i )
+    {
+        bus.Post( Ping( i ) );
+        bus.PollOne();
+    }
+    return sw.PerEvent();
+}
+
+double PostToOtherThread()
+{
+    EventBus bus;
+    bus.Subscribe< Ping >( OnPing );
+    handled = 0;
+    boost::thread consumer( boost::bind( Consume, &bus ) );
+    Stopwatch sw;
+    for ( unsigned i = 0; i < Events; ++i )
+    {
+        bus.Post( Ping( i ) );
+        // si aspetta che l'evento sia stato gestito prima di mandare il successivo
+        while ( handled.load( boost::memory_order_acquire ) <= i )
+            boost::this_thread::yield();
+    }
+    const double result = sw.PerEvent();
+    consumer.join();
+    return result;
+}
+
+double Send()
+{
+    EventBus bus;
+    bus.Subscribe< Ping >( OnPing );
+    handled = 0;
+    Stopwatch sw;
+    for ( unsigned i = 0; i < Events; ++i )
+        bus.Send( Ping( i ) );
+    return sw.PerEvent();
+}
+
+} // namespace
+
+int main()
+{
+    cout << fixed << setprecision( 1 );
+    cout << "delivery                     ns/event" << endl;
+    cout << "Post + PollOne           " << setw( 12 ) << PostAndPoll() << endl;
+    cout << "Post to a Run thread     " << setw( 12 ) << PostToOtherThread() << endl;
+    cout << "Send                     " << setw( 12 ) << Send() << endl;
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Latenza tra Post e l'esecuzione dell'handler nel thread che esegue Run,
+// con le diverse WaitStrategy. Il produttore manda un evento alla volta,
+// a intervalli di Gap, quindi il consumatore trova sempre la coda vuota
+// e misura proprio il costo dell'attesa e del risveglio.
+
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+#include "echidna/eventbus.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+typedef EventBus::Clock Clock;
+
+struct Stamp
+{
+    Stamp( unsigned s, Clock::time_point t ) : seq( s ), posted( t ) {}
+    unsigned seq;
+    Clock::time_point posted;
+};
+
+const unsigned Events = 20000;
+const Clock::duration Gap = boost::chrono::microseconds( 20 );
+
+vector< Clock::duration > latencies( Events );
+boost::atomic< unsigned > handled( 0 );
+
+void OnStamp( const Stamp& s )
+{
+    latencies[ s.seq ] = Clock::now() - s.posted;
+    handled.store( s.seq + 1, boost::memory_order_release );
+}
+
+void Consume( EventBus* bus )
+{
+    while ( handled.load( boost::memory_order_acquire ) < Events )
+        bus -> Run();
+}
+
+double Percentile( const vector< Clock::duration >& sorted, double p )
+{
+    const Clock::duration d = sorted[ static_cast< size_t >( p * ( sorted.size() - 1 ) ) ];
+    return static_cast< double >( boost::chrono::duration_cast< boost::chrono::nanoseconds >( d ).count() );
+}
+
+void Measure( const char* name, const WaitStrategy& strategy )
+{
+    EventBus bus;
+    bus.SetWaitStrategy( strategy );
+    bus.Subscribe< Stamp >( OnStamp );
+    handled = 0;
+    boost::thread consumer( boost::bind( Consume, &bus ) );
+    for ( unsigned i = 0; i < Events; ++i )
+    {
+        // si aspetta l'evento precedente e si lascia al consumatore
+        // il tempo di tornare ad aspettare
+        while ( handled.load( boost::memory_order_acquire ) < i )
+            CpuRelax();
+        const Clock::time_point next = Clock::now() + Gap;
+        while ( Clock::now() < next )
+            CpuRelax();
+        bus.Post( Stamp( i, Clock::now() ) );
+    }
+    consumer.join();
+
+    vector< Clock::duration > sorted( latencies );
+    sort( sorted.begin(), sorted.end() );
+    cout << name
+         << setw( 12 ) << Percentile( sorted, 0.5 )
+         << setw( 12 ) << Percentile( sorted, 0.99 )
+         << setw( 12 ) << Percentile( sorted, 0.999 ) << endl;
+}
+
+} // namespace
+
+int main()
+{
+    const Clock::duration budget = boost::chrono::microseconds( 50 );
+    cout << fixed << setprecision( 0 );
+    // le attese attive hanno senso solo se consumatore e produttore hanno un core ciascuno
+    if ( boost::thread::hardware_concurrency() < 2 )
+        cout << "warning: less than 2 cores, spinning strategies will look much worse" << endl;
+    cout << "wait strategy          p50 ns      p99 ns     p999 ns" << endl;
+    Measure( "block             ", WaitStrategy( WaitStrategy::Block, budget ) );
+    Measure( "park (50 us)      ", WaitStrategy( WaitStrategy::Park, budget ) );
+    Measure( "yield (50 us)     ", WaitStrategy( WaitStrategy::Yield, budget ) );
+    Measure( "spin              ", WaitStrategy( WaitStrategy::Spin, budget ) );
+
+    return 0;
+}
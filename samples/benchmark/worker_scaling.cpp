@@ -0,0 +1,96 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Misura il tempo necessario a gestire un insieme di eventi con handler
+// che impegnano la CPU, al variare del numero di worker dell'EventBus.
+
+#include <iostream>
+#include <iomanip>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "echidna/eventbus.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+struct Job
+{
+    explicit Job( unsigned s ) : seed( s ) {}
+    unsigned seed;
+};
+
+const unsigned Jobs = 20000;
+const unsigned Iterations = 20000;
+
+boost::atomic< unsigned > done( 0 );
+volatile unsigned sink = 0;
+
+void OnJob( const Job& j )
+{
+    // lavoro fittizio che impegna solo la CPU
+    unsigned x = j.seed;
+    for ( unsigned i = 0; i < Iterations; ++i )
+        x = x * 1664525u + 1013904223u;
+    sink = x;
+    ++done;
+}
+
+double Measure( unsigned threads )
+{
+    EventBus bus( threads );
+    bus.Subscribe< Job >( OnJob );
+    done = 0;
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    for ( unsigned i = 0; i < Jobs; ++i )
+        bus.Post( Job( i ) );
+    bus.Poll();
+
+    // con i worker gli handler terminano in modo asincrono
+    while ( done < Jobs )
+        boost::this_thread::yield();
+
+    const boost::posix_time::time_duration elapsed =
+        boost::posix_time::microsec_clock::universal_time() - start;
+    return Jobs / ( elapsed.total_microseconds() / 1000000.0 );
+}
+
+} // namespace
+
+int main()
+{
+    const unsigned threads[] = { 0, 1, 2, 4, 8 };
+
+    cout << "  threads       jobs/sec" << endl;
+    for ( unsigned i = 0; i < sizeof( threads ) / sizeof( threads[ 0 ] ); ++i )
+        cout << setw( 9 ) << threads[ i ] << setw( 15 ) << fixed << setprecision( 0 )
+             << Measure( threads[ i ] ) << endl;
+
+    return 0;
+}
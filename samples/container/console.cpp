@@ -24,7 +24,7 @@
 #include <iostream>
 #include "echidna/component.h"
 #include "echidna/exit.h"
-#include "token.h"
+#include "echidna/task.h"
 
 using namespace std;
 
@@ -38,7 +38,7 @@ public:
     virtual void Start();
     virtual void Stop();
 private:
-    void WaitInput( const Token& );
+    void ReadCommands( echidna::Task& task );
     EventBusPtr broker;
 };
 
@@ -55,14 +55,13 @@ Console::~Console()
 void Console::Init( const std::string& instanceName, CfgPtr cfg, EventBusPtr msgBroker )
 {
     broker = msgBroker;
-    broker -> Subscribe< Token >( boost::bind( &Console::WaitInput, this, _1 ) );
     cout << "Console initialized. Instance " << this << " instance name " << instanceName << endl;
 }
 
 void Console::Start()
 {
     cout << "Console started. Instance " << this << endl;
-    broker -> Post( Token() );
+    echidna::Task::Spawn( *broker, boost::bind( &Console::ReadCommands, this, _1 ) );
 }
 
 void Console::Stop()
@@ -70,21 +69,25 @@ void Console::Stop()
     cout << "Console stopped. Instance " << this << endl;
 }
 
-void Console::WaitInput( const Token& )
+void Console::ReadCommands( echidna::Task& task )
 {
-    // print the prompt:
-    cout << "> ";
-    // wait for a command:
-    string line;
-    getline( cin, line );
-    // check for shutdown:
-    if ( line == "exit" )
-        broker -> Post( echidna::event::Exit() );
-    else
+    for ( ;; )
     {
+        // let the bus deliver the pending events (e.g. the last command)
+        // before showing the prompt
+        task.Yield();
+        // print the prompt:
+        cout << "> ";
+        // wait for a command:
+        string line;
+        getline( cin, line );
+        // check for shutdown:
+        if ( line == "exit" )
+        {
+            broker -> Post( echidna::event::Exit() );
+            return;
+        }
         // send a std::string event with the command
         broker -> Post( line );
-        // send a Token event to schedule again the Console::WaitInput method
-        broker -> Post( Token() );
     }
 }
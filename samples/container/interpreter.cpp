@@ -22,12 +22,16 @@
  ******************************************************************************/
 
 #include <iostream>
-#include <boost/lambda/lambda.hpp>
-#include <boost/lambda/bind.hpp>
+#include "echidna/bridge.h"
 #include "echidna/component.h"
 
 using namespace std;
 
+// the commands typed on the console travel from the default bus
+// to the interpreter's bus (see the bridges section of cfg.xml)
+typedef std::string Command;
+REG_BRIDGE( Command );
+
 DEFINE_COMPONENT( Interpreter )
 {
 public:
@@ -52,11 +56,10 @@ Interpreter::~Interpreter()
 
 void Interpreter::Init( const string& instanceName, CfgPtr cfg, EventBusPtr msgBroker )
 {
-    boost::lambda::placeholder1_type arg;
-    msgBroker -> Subscribe< string >( 
-        boost::bind( &Interpreter::PrintCmdList, this ),
-        //cout << boost::lambda::constant( "received cmd: " ) << arg << '\n',
-        arg == "help"
+    // the handler is looked up by the command string, instead of testing a predicate
+    msgBroker -> SubscribeKey< string >(
+        string( "help" ),
+        boost::bind( &Interpreter::PrintCmdList, this )
     );
     cout << "Interpreter initialized. Instance " << this << " instance name " << instanceName << endl;
 }
@@ -0,0 +1,186 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Two processes exchange events through a shared memory ring (see shmtransport.h).
+//
+//   shm_sample receive    waits for the events of the sender and prints them
+//   shm_sample send       posts the events on its bus, they go to the receiver
+//   shm_sample            forks and runs both
+//
+// Quote is copied byte by byte (PodCodec), Command has a schema-encoded codec.
+
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include "echidna/shmtransport.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+const char* RingName = "echidna_shm_sample";
+const std::size_t RingCapacity = 1024 * 1024;
+const unsigned Quotes = 100000;
+
+struct Quote
+{
+    Quote( unsigned s, double p ) : seq( s ), price( p ) {}
+    unsigned seq;
+    double price;
+};
+
+struct Command
+{
+    explicit Command( const std::string& t ) : text( t ) {}
+    std::string text;
+};
+
+// the length of the text followed by its characters
+struct CommandCodec
+{
+    static std::size_t Size( const Command& c )
+    {
+        return sizeof( boost::uint32_t ) + c.text.size();
+    }
+    static void Encode( const Command& c, char* out )
+    {
+        const boost::uint32_t length = static_cast< boost::uint32_t >( c.text.size() );
+        memcpy( out, &length, sizeof( length ) );
+        memcpy( out + sizeof( length ), c.text.data(), length );
+    }
+    static Command Decode( const char* in, std::size_t size )
+    {
+        boost::uint32_t length;
+        if ( size < sizeof( length ) )
+            throw CodecError( "Command: truncated" );
+        memcpy( &length, in, sizeof( length ) );
+        if ( size != sizeof( length ) + length )
+            throw CodecError( "Command: wrong length" );
+        return Command( std::string( in + sizeof( length ), length ) );
+    }
+};
+
+class Receiver
+{
+public:
+    Receiver() : received( 0 ), outOfOrder( 0 ), quit( false ) {}
+    void OnQuote( const Quote& q )
+    {
+        if ( q.seq != received )
+            ++outOfOrder;
+        ++received;
+    }
+    void OnCommand( const Command& c )
+    {
+        cout << "receiver: command " << c.text << endl;
+        if ( c.text == "quit" )
+            quit = true;
+    }
+    unsigned received;
+    unsigned outOfOrder;
+    bool quit;
+};
+
+int Receive()
+{
+    boost::shared_ptr< EventBus > bus = boost::make_shared< EventBus >();
+    Receiver r;
+    // the components of this process subscribe as usual
+    bus -> Subscribe< Quote >( boost::bind( &Receiver::OnQuote, &r, _1 ) );
+    bus -> Subscribe< Command >( boost::bind( &Receiver::OnCommand, &r, _1 ) );
+
+    ShmReceiver transport( bus, RingName, RingCapacity );
+    transport.Import< Quote >( "Quote" );
+    transport.Import< Command, CommandCodec >( "Command" );
+    transport.Start( WaitStrategy( WaitStrategy::Park, boost::chrono::microseconds( 100 ) ) );
+
+    while ( !r.quit )
+        bus -> Run();
+    transport.Stop();
+
+    cout << "receiver: " << r.received << " quotes, " << r.outOfOrder << " out of order, "
+         << transport.Discarded() << " discarded" << endl;
+    ShmRing::Remove( RingName );
+    return r.received == Quotes && r.outOfOrder == 0 ? 0 : 1;
+}
+
+int Send()
+{
+    boost::shared_ptr< EventBus > bus = boost::make_shared< EventBus >();
+    ShmSender transport( bus, RingName, RingCapacity );
+    transport.Export< Quote >( "Quote" );
+    transport.Export< Command, CommandCodec >( "Command" );
+
+    bus -> Post( Command( "start" ) );
+    for ( unsigned i = 0; i < Quotes; ++i )
+    {
+        bus -> Post( Quote( i, 100.0 + i % 100 ) );
+        // deliver to the ring a block at a time, leaving the receiver the time to read it
+        if ( i % 1000 == 999 )
+        {
+            bus -> Poll();
+            boost::this_thread::sleep_for( boost::chrono::milliseconds( 1 ) );
+        }
+    }
+    bus -> Post( Command( "quit" ) );
+    bus -> Poll();
+
+    cout << "sender: " << Quotes << " quotes, " << transport.Dropped() << " dropped" << endl;
+    return transport.Dropped() == 0 ? 0 : 1;
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    const std::string role = argc > 1 ? argv[ 1 ] : "";
+    if ( role == "receive" )
+        return Receive();
+    if ( role == "send" )
+        return Send();
+    if ( !role.empty() )
+    {
+        cerr << "usage: " << argv[ 0 ] << " [send|receive]" << endl;
+        return 1;
+    }
+
+    ShmRing::Remove( RingName );
+    const pid_t child = fork();
+    if ( child < 0 )
+    {
+        cerr << "fork failed" << endl;
+        return 1;
+    }
+    if ( child == 0 )
+        return Receive();
+    const int sent = Send();
+    int status = 0;
+    waitpid( child, &status, 0 );
+    return sent == 0 && WIFEXITED( status ) && WEXITSTATUS( status ) == 0 ? 0 : 1;
+}
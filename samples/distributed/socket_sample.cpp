@@ -0,0 +1,209 @@
+/*******************************************************************************
+ * echidna - A framework for event based reactive systems
+ * Copyright (C) 2012 Daniele Pallastrelli 
+ *
+ *
+ * This file is part of echidna.
+ * For more information, see http://echidna.googlecode.com/
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ ******************************************************************************/
+
+// Two processes mirror events through a socket (see EventMirror and SocketLink).
+//
+//   socket_sample receive [address]    waits for the sender and counts its events
+//   socket_sample send [address]       posts the events on its bus, they go to the receiver
+//   socket_sample                      forks and runs both
+//
+// address is host:port for TCP or unix:path (default unix:/tmp/echidna_socket_sample).
+// Quote is copied byte by byte (PodCodec), Command is mirrored as a string.
+
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include "echidna/sockettransport.h"
+
+using namespace std;
+using namespace echidna;
+
+namespace
+{
+
+const unsigned Quotes = 1000000;
+
+struct Quote
+{
+    Quote( unsigned s, double p ) : seq( s ), price( p ) {}
+    unsigned seq;
+    double price;
+};
+
+struct Command
+{
+    explicit Command( const std::string& t ) : text( t ) {}
+    std::string text;
+};
+
+struct CommandSerializer
+{
+    static std::string ToStream( const Command& c ) { return c.text; }
+    static Command FromStream( const std::string& s ) { return Command( s ); }
+};
+
+typedef boost::chrono::steady_clock Clock;
+
+class Receiver
+{
+public:
+    Receiver() : received( 0 ), outOfOrder( 0 ), quit( false ) {}
+    void OnQuote( const Quote& q )
+    {
+        if ( received == 0 )
+            start = Clock::now();
+        if ( q.seq != received )
+            ++outOfOrder;
+        ++received;
+    }
+    void OnCommand( const Command& c )
+    {
+        if ( c.text == "quit" )
+        {
+            stop = Clock::now();
+            quit = true;
+        }
+    }
+    unsigned received;
+    unsigned outOfOrder;
+    bool quit;
+    Clock::time_point start;
+    Clock::time_point stop;
+};
+
+int Receive( const std::string& address )
+{
+    boost::shared_ptr< EventBus > bus = boost::make_shared< EventBus >();
+    Receiver r;
+    bus -> Subscribe< Quote >( boost::bind( &Receiver::OnQuote, &r, _1 ) );
+    bus -> Subscribe< Command >( boost::bind( &Receiver::OnCommand, &r, _1 ) );
+
+    boost::shared_ptr< SocketLink > link = SocketLink::Accept( bus, address );
+    EventMirror< Quote, PodCodec< Quote > > quotes( bus, link, "Quote", MirrorLink::Incoming );
+    EventMirror< Command, CommandSerializer > commands( bus, link, "Command", MirrorLink::Incoming );
+
+    while ( !r.quit && link -> Open() )
+        bus -> Run();
+    link -> Close();
+
+    const double seconds = boost::chrono::duration< double >( r.stop - r.start ).count();
+    cout << "receiver: " << r.received << " quotes, " << r.outOfOrder << " out of order";
+    if ( r.quit && seconds > 0 )
+        cout << ", " << static_cast< unsigned long >( r.received / seconds ) << " events/s";
+    cout << endl;
+    return r.received == Quotes && r.outOfOrder == 0 ? 0 : 1;
+}
+
+void RunUntilClosed( boost::shared_ptr< EventBus > bus, boost::shared_ptr< SocketLink > link )
+{
+    while ( link -> Open() )
+        bus -> Run();
+}
+
+int Send( const std::string& address )
+{
+    boost::shared_ptr< EventBus > bus = boost::make_shared< EventBus >();
+    boost::shared_ptr< SocketLink > link;
+    // the receiver may not be listening yet
+    for ( unsigned attempt = 0; !link; ++attempt )
+    {
+        try
+        {
+            link = SocketLink::Connect( bus, address );
+        }
+        catch ( const boost::system::system_error& e )
+        {
+            if ( attempt == 50 )
+            {
+                cerr << "sender: " << e.what() << endl;
+                return 1;
+            }
+            boost::this_thread::sleep_for( boost::chrono::milliseconds( 100 ) );
+        }
+    }
+    // one strand for both mirrors: with a thread pool the quotes and
+    // the commands are sent in the order they were posted
+    const EventBus::StrandPtr order = bus -> NewStrand();
+    EventMirror< Quote, PodCodec< Quote > > quotes( bus, link, "Quote", MirrorLink::Outgoing, order );
+    EventMirror< Command, CommandSerializer > commands( bus, link, "Command", MirrorLink::Outgoing, order );
+    boost::thread loop( boost::bind( RunUntilClosed, bus, link ) );
+
+    for ( unsigned i = 0; i < Quotes; ++i )
+    {
+        bus -> Post( Quote( i, 100.0 + i % 100 ) );
+        // don't let the socket buffer grow when the receiver is slower
+        if ( i % 1000 == 999 )
+            while ( link -> Pending() > 1024 * 1024 )
+                boost::this_thread::yield();
+    }
+    bus -> Post( Command( "quit" ) );
+    // the receiver closes the connection when it gets quit
+    loop.join();
+
+    cout << "sender: " << Quotes << " quotes, " << link -> Dropped() << " dropped" << endl;
+    return link -> Dropped() == 0 ? 0 : 1;
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    const std::string role = argc > 1 ? argv[ 1 ] : "";
+    const std::string address = argc > 2 ? argv[ 2 ] : "unix:/tmp/echidna_socket_sample";
+    try
+    {
+        if ( role == "receive" )
+            return Receive( address );
+        if ( role == "send" )
+            return Send( address );
+        if ( !role.empty() )
+        {
+            cerr << "usage: " << argv[ 0 ] << " [send|receive [address]]" << endl;
+            return 1;
+        }
+
+        const pid_t child = fork();
+        if ( child < 0 )
+        {
+            cerr << "fork failed" << endl;
+            return 1;
+        }
+        if ( child == 0 )
+            return Receive( address );
+        const int sent = Send( address );
+        int status = 0;
+        waitpid( child, &status, 0 );
+        return sent == 0 && WIFEXITED( status ) && WEXITSTATUS( status ) == 0 ? 0 : 1;
+    }
+    catch ( const std::exception& e )
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}